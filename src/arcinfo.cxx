@@ -16,42 +16,187 @@
 #include "comm-arc.h"
 #include "unrarapi.h"
 #include "util.h"
+#include "hdrindex.h"
 #include "arcinfo.h"
+#include "unrar32.h"
 
-arcinfo *arcinfo::m_chain;
+critical_section arcinfo::m_table_lock;
+arcinfo::slot *arcinfo::m_slots;
+int arcinfo::m_nslots;
+int arcinfo::m_free = -1;
+void *arcinfo::m_pool;
+void *arcinfo::m_chunks;
+
+/* A handle is the index of its slot plus one in the low 16 bits, and
+   the slot's generation in the high 16 bits.  The generation changes
+   every time the slot is freed, so that a handle that has been closed
+   is not taken for the one that reuses its slot. */
+HARC
+arcinfo::attach (arcinfo *p)
+{
+  cs_lock lock (m_table_lock);
+  if (m_free < 0)
+    {
+      if (m_nslots == MAX_SLOTS)
+        return 0;
+      int n = min (max (m_nslots * 2, 16), int (MAX_SLOTS));
+      slot *x = (slot *)realloc (m_slots, sizeof *x * n);
+      if (!x)
+        return 0;
+      m_slots = x;
+      for (int i = n - 1; i >= m_nslots; i--)
+        {
+          m_slots[i].info = 0;
+          m_slots[i].gen = 1;
+          m_slots[i].next = m_free;
+          m_free = i;
+        }
+      m_nslots = n;
+    }
+  int i = m_free;
+  m_free = m_slots[i].next;
+  m_slots[i].info = p;
+  return HARC ((size_t (m_slots[i].gen) << 16) | (i + 1));
+}
+
+void
+arcinfo::detach (HARC harc)
+{
+  cs_lock lock (m_table_lock);
+  int i = int (reinterpret_cast <size_t> (harc) & 0xffff) - 1;
+  slot &s = m_slots[i];
+  s.info = 0;
+  s.gen = WORD (s.gen == 0xffff ? 1 : s.gen + 1);
+  s.next = m_free;
+  m_free = i;
+}
 
 arcinfo *
 arcinfo::find (HARC harc)
 {
-  for (arcinfo *p = m_chain; p; p = p->m_next)
-    if (reinterpret_cast <arcinfo *> (harc) == p)
-      return p;
+  size_t x = reinterpret_cast <size_t> (harc);
+  u_int i = u_int (x & 0xffff) - 1;
+  if (i >= u_int (m_nslots))
+    return 0;
+  const slot &s = m_slots[i];
+  return s.info && s.gen == x >> 16 ? s.info : 0;
+}
+
+/* Finds the archive of HARC and locks it for the calling thread. */
+arcinfo *
+arcinfo::acquire (HARC harc)
+{
+  arcinfo *p;
+  {
+    cs_lock lock (m_table_lock);
+    p = find (harc);
+    if (!p)
+      return 0;
+    p->m_refs++;
+  }
+  p->m_lock.lock ();
+  if (p->m_closed)
+    {
+      release (p);
+      return 0;
+    }
+  return p;
+}
+
+void
+arcinfo::release (arcinfo *p)
+{
+  p->m_lock.unlock ();
+  cs_lock lock (m_table_lock);
+  if (!--p->m_refs && p->m_closed)
+    delete p;
+}
+
+/* Closes the archive of HARC and frees the handle.  The arcinfo itself
+   goes when the last thread holding it lets it go. */
+int
+arcinfo::destroy (HARC harc)
+{
+  arcinfo *p = acquire (harc);
+  if (!p)
+    return ERROR_HARC_ISNOT_OPENED;
+  p->close ();
+  detach (p->m_harc);
+  p->m_harc = 0;
+  p->m_closed = true;
+  release (p);
   return 0;
 }
 
 void
 arcinfo::cleanup ()
 {
-  while (m_chain)
-    delete m_chain;
+  for (int i = 0; i < m_nslots; i++)
+    if (m_slots[i].info)
+      delete m_slots[i].info;
+  free (m_slots);
+  m_slots = 0;
+  m_nslots = 0;
+  m_free = -1;
+  while (m_chunks)
+    {
+      void *next = *(void **)m_chunks;
+      free (m_chunks);
+      m_chunks = next;
+    }
+  m_pool = 0;
+}
+
+/* arcinfo objects are carved out of chunks of POOL_CHUNK, and reused
+   once freed.  The chunks are released by cleanup. */
+void *
+arcinfo::operator new (size_t size) throw ()
+{
+  cs_lock lock (m_table_lock);
+  if (!m_pool)
+    {
+      size_t stride = (size + 7) & ~7;
+      char *chunk = (char *)malloc (8 + stride * POOL_CHUNK);
+      if (!chunk)
+        return 0;
+      *(void **)chunk = m_chunks;
+      m_chunks = chunk;
+      for (int i = POOL_CHUNK - 1; i >= 0; i--)
+        {
+          void *p = chunk + 8 + stride * i;
+          *(void **)p = m_pool;
+          m_pool = p;
+        }
+    }
+  void *p = m_pool;
+  m_pool = *(void **)p;
+  return p;
+}
+
+void
+arcinfo::operator delete (void *p)
+{
+  cs_lock lock (m_table_lock);
+  if (p)
+    {
+      *(void **)p = m_pool;
+      m_pool = p;
+    }
 }
 
 arcinfo::arcinfo ()
-     : m_hunrar (0), m_prev (0), m_next (m_chain),m_is_missing_password(false)
+     : m_hunrar (0), m_is_missing_password(false),
+       m_index_pos (0), m_from_index (false), m_recording (false),
+       m_names (sizeof (int)), m_names_built (false), m_refs (0),
+       m_closed (false)
 {
-  if (m_next)
-    m_next->m_prev = this;
-  m_chain = this;
+  m_harc = attach (this);
 }
 
 arcinfo::~arcinfo ()
 {
-  if (m_prev)
-    m_prev->m_next = m_next;
-  else
-    m_chain = m_next;
-  if (m_next)
-    m_next->m_prev = m_prev;
+  if (m_harc)
+    detach (m_harc);
   close ();
 }
 
@@ -71,7 +216,7 @@ arcinfo::open (const char *filename, DWORD mode)
   FileTimeToLocalFileTime (&fd.ftLastWriteTime, &lt);
   if (!FileTimeToDosDateTime (&lt, &m_arcdate, &m_arctime))
     m_arcdate = m_arctime = WORD (-1);
-  m_sfx = file_executable_p (filename) ? SFX_WIN32_UNKNOWN : 0;
+  m_sfx = -1;
 
   m_orig_sz.d = 0;
   m_comp_sz.d = 0;
@@ -79,8 +224,20 @@ arcinfo::open (const char *filename, DWORD mode)
   m_is_valid = false;
   m_is_eof = false;
 
+  /* The headers are only read at open when they are wanted all at once
+     or are to be cached; otherwise UnRAR.DLL reads them as the search
+     goes. */
+  m_from_index = ((header_index::enabled () && m_index.load (filename))
+                  || (eager () && m_index.build (filename)));
+  if (m_from_index)
+    {
+      rewind ();
+      return true;
+    }
+
   rarOpenArchiveData oad (filename, RAR_OM_LIST);
   m_hunrar = rarOpenArchive (&oad);
+  m_recording = m_hunrar && header_index::enabled ();
   return m_hunrar != 0;
 }
 
@@ -96,23 +253,171 @@ arcinfo::close ()
   return 0;
 }
 
+/* Tells whether open reads the headers itself. */
+bool
+arcinfo::eager () const
+{
+  return m_mode & M_SNAPSHOT_HEADERS || header_index::enabled ();
+}
+
+/* Reads all the headers into m_index and closes the archive, so that
+   searches become scans of the index that can be started over, and
+   the totals are known before the first one.  They are read straight
+   from the archive unless open already failed to.  Returns 0, or the
+   error that kept UnRAR.DLL from reading through to the end; the
+   index is then not used. */
 int
-arcinfo::findnext (INDIVIDUALINFO *vinfo, bool skip)
+arcinfo::snapshot ()
 {
-  do
+  if (m_from_index)
+    return 0;
+  if (!eager () && m_index.build (m_arcpath))
+    {
+      close ();
+      m_from_index = true;
+      rewind ();
+      return 0;
+    }
+  m_recording = true;
+  int n = 0, e;
+  for (bool skip = false; !(e = read_next (skip)); skip = true)
+    n++;
+  if (m_is_missing_password)
+    return ERROR_PASSWORD_FILE;
+  switch (e)
     {
-      if (m_is_eof
-          || (skip && rarProcessFile (m_hunrar, RAR_SKIP, 0, 0))
-          || rarReadHeaderEx (m_hunrar, &m_hd))
+    case ERAR_END_ARCHIVE:
+      break;
+
+    case ERAR_BAD_DATA:
+      return ERROR_HEADER_BROKEN;
+
+    case ERAR_EOPEN:
+      return ERROR_ARC_FILE_OPEN;
+
+    case ERAR_EREAD:
+      return ERROR_CANNOT_READ;
+
+    default:
+      return ERROR_UNEXPECTED;
+    }
+  if (n != m_index.count ())
+    return ERROR_ENOUGH_MEMORY;
+  close ();
+  m_from_index = true;
+  rewind ();
+  return 0;
+}
+
+/* Starts a search of the index over from the first header, and sums up
+   the sizes of all the headers that match. */
+void
+arcinfo::rewind ()
+{
+  bool strict = (m_mode & M_CHECK_ALL_PATH) != 0;
+  m_index_pos = 0;
+  m_is_eof = false;
+  m_is_valid = false;
+  m_orig_sz.d = 0;
+  m_comp_sz.d = 0;
+  for (int i = 0; i < m_index.count (); i++)
+    if (m_glob.match (m_index.name (i), strict, 0))
+      {
+        m_orig_sz.d += m_index.unp_size (i);
+        m_comp_sz.d += m_index.pack_size (i);
+      }
+}
+
+/* Returns the position in m_index of the header named NAME, or -1.
+   The headers are read all at once and hashed by name the first time,
+   which cannot be done once a search of the archive itself has
+   started; if reading them fails, the error is left in ERR.  Of
+   several headers of the same name, the first is found. */
+int
+arcinfo::lookup (const char *name, int &err)
+{
+  err = 0;
+  if (!m_from_index
+      && (!m_is_first_time || (err = snapshot ()) != 0))
+    return -1;
+  if (!m_names_built)
+    {
+      for (int i = 0; i < m_index.count (); i++)
+        {
+          const char *s = m_index.name (i);
+          int *p = (int *)m_names.insert (s, strlen (s));
+          if (!p)
+            {
+              m_names.clear ();
+              return -1;
+            }
+          if (!*p)
+            *p = i + 1;
+        }
+      m_names_built = true;
+    }
+  int *p = (int *)m_names.find (name, strlen (name));
+  return p ? *p - 1 : -1;
+}
+
+/* Returns the SFX type of the archive, probing the file only the first
+   time it is asked for. */
+int
+arcinfo::sfx ()
+{
+  __int64 marker;
+  if (m_sfx < 0)
+    m_sfx = probe_sfx (m_arcpath, &marker);
+  return m_sfx;
+}
+
+/* Reads the next header from UnRAR.DLL into m_hd.  A listing read
+   through to the end is saved in the cache. */
+int
+arcinfo::read_next (bool skip)
+{
+  int e;
+  if (skip && (e = rarProcessFile (m_hunrar, RAR_SKIP, 0, 0)))
+    {
+      m_recording = false;
+      return e;
+    }
+  e = rarReadHeaderEx (m_hunrar, &m_hd);
+  if (m_recording)
+    {
+      if (!e)
+        m_recording = m_index.add (m_hd);
+      else
         {
-          m_is_eof = true;
-          m_is_valid = false;
-          if(m_is_missing_password){
-            return ERROR_PASSWORD_FILE;
-          }else{
-            return -1;
-          }
+          if (e == ERAR_END_ARCHIVE && !m_is_missing_password
+              && header_index::enabled ())
+            m_index.save (m_arcpath);
+          m_recording = false;
         }
+    }
+  return e;
+}
+
+bool
+arcinfo::next_indexed ()
+{
+  bool strict = (m_mode & M_CHECK_ALL_PATH) != 0;
+  for (; m_index_pos < m_index.count (); m_index_pos++)
+    if (m_glob.match (m_index.name (m_index_pos), strict, 0))
+      {
+        m_index.get (m_index_pos++, m_hd);
+        return true;
+      }
+  return false;
+}
+
+bool
+arcinfo::next_live (bool skip)
+{
+  do
+    {
+      if (m_is_eof || read_next (skip))
+        return false;
       skip = true;
     }
   while (!m_glob.match (m_hd.FileName, (m_mode & M_CHECK_ALL_PATH) != 0, 0));
@@ -121,6 +426,22 @@ arcinfo::findnext (INDIVIDUALINFO *vinfo, bool skip)
   m_orig_sz.s.h += m_hd.UnpSizeHigh;
   m_comp_sz.d += m_hd.PackSize;
   m_comp_sz.s.h += m_hd.PackSizeHigh;
+  return true;
+}
+
+int
+arcinfo::findnext (INDIVIDUALINFO *vinfo, bool skip)
+{
+  if (m_from_index ? !next_indexed () : !next_live (skip))
+    {
+      m_is_eof = true;
+      m_is_valid = false;
+      if(m_is_missing_password){
+        return ERROR_PASSWORD_FILE;
+      }else{
+        return -1;
+      }
+    }
   m_is_valid = true;
 
   if (vinfo)
@@ -135,7 +456,7 @@ arcinfo::findnext (INDIVIDUALINFO *vinfo, bool skip)
       vinfo->wDate = HIWORD (m_hd.FileTime);
       vinfo->wTime = LOWORD (m_hd.FileTime);
       strlcpy (vinfo->szFileName, m_hd.FileName, sizeof vinfo->szFileName);
-      strcpy (vinfo->szAttribute, attr_string (m_hd.FileAttr));
+      attr_string (m_hd.FileAttr, vinfo->szAttribute);
       strcpy (vinfo->szMode, method_string (m_hd.Method));
     }
   return 0;
@@ -35,19 +35,82 @@ public:
   bool m_is_eof;
   char m_arcpath[MAX_PATH + 1];
   bool m_is_missing_password;
+  header_index m_index;
+  int m_index_pos;
+  bool m_from_index;
+  bool m_recording;
+  path_set m_names;
+  bool m_names_built;
 
   arcinfo ();
   ~arcinfo ();
   bool open (const char *filename, DWORD mode);
   int close ();
+  int snapshot ();
+  void rewind ();
+  int lookup (const char *name, int &err);
+  int sfx ();
   int findnext (INDIVIDUALINFO *vinfo, bool skip);
-  static arcinfo *find (HARC);
+  HARC harc () const
+    {return m_harc;}
+  static arcinfo *acquire (HARC);
+  static void release (arcinfo *);
+  static int destroy (HARC);
   static void cleanup ();
+  static void *operator new (size_t size) throw ();
+  static void operator delete (void *p);
+
+private:
+  bool eager () const;
+  int read_next (bool skip);
+  bool next_indexed ();
+  bool next_live (bool skip);
+
+  enum {MAX_SLOTS = 0xffff, POOL_CHUNK = 16};
+  struct slot
+    {
+      arcinfo *info;
+      int next;
+      WORD gen;
+    };
+
+  HARC m_harc;
+  critical_section m_lock;
+  int m_refs;
+  bool m_closed;
+  static critical_section m_table_lock;
+  static slot *m_slots;
+  static int m_nslots;
+  static int m_free;
+  static void *m_pool;
+  static void *m_chunks;
 
+  static arcinfo *find (HARC);
+  static HARC attach (arcinfo *);
+  static void detach (HARC);
+  void operator = (const arcinfo &);
+  arcinfo (const arcinfo &);
+};
+
+/* An open archive, held for the duration of an API call.  Calls on
+   the same handle are serialized; calls on different handles are not.
+   A handle closed while it is held is deleted when it is let go. */
+class arcinfo_ref
+{
+public:
+  arcinfo_ref (HARC harc)
+       : m_info (arcinfo::acquire (harc))
+    {}
+  ~arcinfo_ref ()
+    {if (m_info) arcinfo::release (m_info);}
+  operator arcinfo * () const
+    {return m_info;}
+  arcinfo *operator -> () const
+    {return m_info;}
 private:
-  arcinfo *m_prev;
-  arcinfo *m_next;
-  static arcinfo *m_chain;
+  arcinfo *m_info;
+  void operator = (const arcinfo_ref &);
+  arcinfo_ref (const arcinfo_ref &);
 };
 
 #endif /* _arcinfo_h_ */
@@ -253,14 +253,13 @@ progress_dlg::update (const int64 &n) const
   return 1;
 }
 
-static char passwd[128];
-
 static INT_PTR CALLBACK
 askpass_dlgproc (HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam)
 {
   switch (msg)
     {
     case WM_INITDIALOG:
+      SetWindowLongPtr (hwnd, DWLP_USER, lparam);
       center_window (hwnd);
       return 1;
 
@@ -268,7 +267,9 @@ askpass_dlgproc (HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam)
       switch (LOWORD (wparam))
         {
         case IDOK:
-          GetDlgItemText (hwnd, IDC_PASSWD, passwd, sizeof passwd - 1);
+          GetDlgItemText (hwnd, IDC_PASSWD,
+                          (char *)GetWindowLongPtr (hwnd, DWLP_USER),
+                          PASSWD_MAX - 1);
           /* fall thru... */
         case IDCANCEL:
           EndDialog (hwnd, LOWORD (wparam));
@@ -279,23 +280,25 @@ askpass_dlgproc (HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam)
   return 0;
 }
 
+/* Asks for a password, and stores it in BUF of PASSWD_MAX bytes. */
 char *
-askpass_dialog (HWND hwnd_parent)
+askpass_dialog (HWND hwnd_parent, char *buf)
 {
-  return DialogBox (lstate.hinst, MAKEINTRESOURCE (IDD_ASKPASSWD),
-                    hwnd_parent, askpass_dlgproc) == IDOK ? passwd : 0;
+  *buf = 0;
+  return DialogBoxParam (lstate.hinst, MAKEINTRESOURCE (IDD_ASKPASSWD),
+                         hwnd_parent, askpass_dlgproc,
+                         LPARAM (buf)) == IDOK ? buf : 0;
 }
 
-static char *vol_name;
-
 static INT_PTR CALLBACK
 changevol_dlgproc (HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam)
 {
   switch (msg)
     {
     case WM_INITDIALOG:
+      SetWindowLongPtr (hwnd, DWLP_USER, lparam);
       center_window (hwnd);
-      SetDlgItemText (hwnd, IDC_PATH, vol_name);
+      SetDlgItemText (hwnd, IDC_PATH, (char *)lparam);
       return 1;
 
     case WM_COMMAND:
@@ -330,7 +333,7 @@ changevol_dlgproc (HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam)
             GetDlgItemText (hwnd, IDC_PATH, buf, sizeof buf);
             if (!*buf)
               return 1;
-            strcpy (vol_name, buf);
+            strcpy ((char *)GetWindowLongPtr (hwnd, DWLP_USER), buf);
           }
           /* fall thru... */
         case IDCANCEL:
@@ -345,7 +348,6 @@ changevol_dlgproc (HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam)
 int
 change_vol_dialog (HWND hwnd_parent, char *path)
 {
-  vol_name = path;
-  return (DialogBox (lstate.hinst, MAKEINTRESOURCE (IDD_CHANGEVOL),
-    hwnd_parent, changevol_dlgproc) == IDOK) ? 1 : -1;
+  return (DialogBoxParam (lstate.hinst, MAKEINTRESOURCE (IDD_CHANGEVOL),
+    hwnd_parent, changevol_dlgproc, LPARAM (path)) == IDOK) ? 1 : -1;
 }
@@ -47,7 +47,9 @@ public:
   BOOL wndproc (UINT msg, WPARAM wparam, LPARAM lparam);
 };
 
-char *askpass_dialog (HWND hwnd_parent);
+void doevents ();
+#define PASSWD_MAX 128
+char *askpass_dialog (HWND hwnd_parent, char *buf);
 int change_vol_dialog (HWND hwnd_parent, char *path);
 
 #endif
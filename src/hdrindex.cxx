@@ -0,0 +1,755 @@
+/*
+ *   Copyright (c) 1998-2004 T. Kamei (kamei@jsdlab.co.jp)
+ *
+ *   Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose is hereby granted provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies of the software and related documentation.
+ *
+ *                          NO WARRANTY
+ *
+ *   THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY WARRANTIES;
+ * WITHOUT EVEN THE IMPLIED WARRANTIES OF MERCHANTABILITY OR FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ */
+
+#include "comm-arc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <process.h>
+#include "unrarapi.h"
+#include "util.h"
+#include "hdrindex.h"
+#include "mapf.h"
+#include "rarhdr.h"
+#include "unrar32.h"
+
+#define INDEX_MAGIC "UR32IDX\2"
+#define INDEX_SUFFIX ".idx"
+#define DEFAULT_CACHE_SIZE (64 * 1024 * 1024)
+#define MAX_INDEX_RECORDS (16 * 1024 * 1024)
+#define MAX_INDEX_POOL (256 * 1024 * 1024)
+#define MAX_VOLUMES 100000
+#define SCAN_STACK_SIZE (64 * 1024)
+
+#ifndef STACK_SIZE_PARAM_IS_A_RESERVATION
+#define STACK_SIZE_PARAM_IS_A_RESERVATION 0x00010000
+#endif
+
+struct index_header
+{
+  char magic[8];
+  DWORD path_len;
+  DWORD size;
+  DWORD size_high;
+  FILETIME mtime;
+  DWORD nrecs;
+  DWORD pool_size;
+  DWORD crc;
+};
+
+static critical_section cache_lock;
+static char cache_dir[MAX_PATH + 1];
+static DWORD cache_max;
+/* The size of the indexes in the cache, kept up to date by save and
+   evict, or -1 until the directory has been scanned. */
+static __int64 cache_total = -1;
+
+bool
+header_index::configure (const char *dir, DWORD max_size)
+{
+  cs_lock lock (cache_lock);
+  *cache_dir = 0;
+  if (!dir || !*dir)
+    return true;
+  if (strlen (dir) >= MAX_PATH - 32)
+    return false;
+  CreateDirectory (dir, 0);
+  DWORD a = GetFileAttributes (dir);
+  if (a == -1 || !(a & FILE_ATTRIBUTE_DIRECTORY))
+    return false;
+  strcpy (cache_dir, dir);
+  char *sl = find_last_slash (cache_dir);
+  if (sl && !sl[1])
+    *sl = 0;
+  cache_max = max_size ? max_size : DEFAULT_CACHE_SIZE;
+  cache_total = -1;
+  return true;
+}
+
+bool
+header_index::enabled ()
+{
+  cs_lock lock (cache_lock);
+  return *cache_dir != 0;
+}
+
+const int header_index::col_width[NCOLUMNS] =
+{
+  sizeof (__int64),             /* COL_UNP_SIZE */
+  sizeof (__int64),             /* COL_PACK_SIZE */
+  sizeof (DWORD),               /* COL_NAME */
+  sizeof (DWORD),               /* COL_CRC */
+  sizeof (DWORD),               /* COL_TIME */
+  sizeof (DWORD),               /* COL_ATTR */
+  sizeof (DWORD),               /* COL_FLAGS */
+  sizeof (WORD),                /* COL_METHOD */
+  sizeof (BYTE),                /* COL_HOST_OS */
+  sizeof (BYTE),                /* COL_UNP_VER */
+};
+
+#define COLUMN(type, c) ((type *)m_col[c])
+
+void
+header_index::clear ()
+{
+  free (m_block);
+  free (m_pool);
+  m_block = 0;
+  m_pool = 0;
+  m_nrecs = m_maxrecs = 0;
+  m_pool_size = m_pool_max = 0;
+}
+
+DWORD
+header_index::record_size ()
+{
+  DWORD n = 0;
+  for (int c = 0; c < NCOLUMNS; c++)
+    n += col_width[c];
+  return n;
+}
+
+/* Points the columns into BLOCK, which has room for N records.  The
+   widest columns come first to keep every column aligned. */
+void
+header_index::layout (char *block, int n)
+{
+  for (int c = 0; c < NCOLUMNS; c++)
+    {
+      m_col[c] = block;
+      block += col_width[c] * n;
+    }
+}
+
+bool
+header_index::reserve (int n)
+{
+  if (n <= m_maxrecs)
+    return true;
+  char *block = (char *)malloc (record_size () * n);
+  if (!block)
+    return false;
+  char *p = block;
+  for (int c = 0; c < NCOLUMNS; c++)
+    {
+      if (m_nrecs)
+        memcpy (p, m_col[c], col_width[c] * m_nrecs);
+      p += col_width[c] * n;
+    }
+  free (m_block);
+  m_block = block;
+  m_maxrecs = n;
+  layout (block, n);
+  return true;
+}
+
+/* Makes room for a record of FLAGS and a name of up to NAME_MAX bytes
+   with its terminator, and returns the record's position, or -1.  The
+   name goes at the end of the pool, where the caller copies it. */
+int
+header_index::append (DWORD flags, DWORD name_max)
+{
+  if (flags & (FRAR_PREVVOL | FRAR_NEXTVOL))
+    m_cacheable = false;
+
+  if (m_nrecs == m_maxrecs
+      && !reserve (m_maxrecs ? m_maxrecs * 2 : 256))
+    return -1;
+  if (m_pool_size + name_max > m_pool_max)
+    {
+      DWORD n = max (m_pool_max * 2, m_pool_size + name_max + 4096);
+      char *x = (char *)realloc (m_pool, n);
+      if (!x)
+        return -1;
+      m_pool = x;
+      m_pool_max = n;
+    }
+  int i = m_nrecs++;
+  COLUMN (DWORD, COL_NAME)[i] = m_pool_size;
+  return i;
+}
+
+bool
+header_index::add (const rarHeaderData &hd)
+{
+  DWORD l = strlen (hd.FileName) + 1;
+  int i = append (hd.Flags, l);
+  if (i < 0)
+    return false;
+  int64 u, p;
+  u.s.l = hd.UnpSize;
+  u.s.h = hd.UnpSizeHigh;
+  p.s.l = hd.PackSize;
+  p.s.h = hd.PackSizeHigh;
+  COLUMN (__int64, COL_UNP_SIZE)[i] = u.d;
+  COLUMN (__int64, COL_PACK_SIZE)[i] = p.d;
+  COLUMN (DWORD, COL_CRC)[i] = hd.FileCRC;
+  COLUMN (DWORD, COL_TIME)[i] = hd.FileTime;
+  COLUMN (DWORD, COL_ATTR)[i] = hd.FileAttr;
+  COLUMN (DWORD, COL_FLAGS)[i] = hd.Flags;
+  COLUMN (WORD, COL_METHOD)[i] = WORD (hd.Method);
+  COLUMN (BYTE, COL_HOST_OS)[i] = BYTE (hd.HostOS);
+  COLUMN (BYTE, COL_UNP_VER)[i] = BYTE (hd.UnpVer);
+  memcpy (m_pool + m_pool_size, hd.FileName, l);
+  m_pool_size += l;
+  return true;
+}
+
+/* Adds a header read by rar_headers, converting its name straight into
+   the pool.  An ANSI name is never longer than the same name in UTF-8
+   or in the OEM code page; one decoded from a RAR 1.5-4.x Unicode name
+   may be. */
+bool
+header_index::add (const rar_entry &e)
+{
+  DWORD l = (e.name_enc ? FRAR_PATH_MAX
+             : min (e.name_len, DWORD (FRAR_PATH_MAX - 1)) + 1);
+  int i = append (e.flags, l);
+  if (i < 0)
+    return false;
+  COLUMN (__int64, COL_UNP_SIZE)[i] = e.unp_size;
+  COLUMN (__int64, COL_PACK_SIZE)[i] = e.pack_size;
+  COLUMN (DWORD, COL_CRC)[i] = e.crc;
+  COLUMN (DWORD, COL_TIME)[i] = e.time;
+  COLUMN (DWORD, COL_ATTR)[i] = e.attr;
+  COLUMN (DWORD, COL_FLAGS)[i] = e.flags;
+  COLUMN (WORD, COL_METHOD)[i] = WORD (e.method);
+  COLUMN (BYTE, COL_HOST_OS)[i] = BYTE (e.host_os);
+  COLUMN (BYTE, COL_UNP_VER)[i] = BYTE (e.unp_ver);
+  int n = e.copy_name (m_pool + m_pool_size, l);
+  if (n < 0)
+    {
+      m_nrecs--;
+      return false;
+    }
+  m_pool_size += n + 1;
+  return true;
+}
+
+/* Reads the file headers of ARCPATH straight from the archive, and
+   saves them in the cache if it is enabled.  A first volume brings in
+   the rest of its set, which is never cached.  Fails for archives with
+   encrypted headers, volumes other than the first, and anything
+   UnRAR.DLL should look at instead; the index is then left empty. */
+bool
+header_index::build (const char *arcpath)
+{
+  clear ();
+  rar_headers rh;
+  if (rh.open (arcpath) || rh.flags () & UNRAR_ARC_ENCRYPTED_HEADERS)
+    return false;
+  if (rh.flags () & UNRAR_ARC_VOLUME)
+    return (rh.flags () & UNRAR_ARC_FIRSTVOLUME
+            && build_volumes (arcpath, rh.new_numbering ()));
+  rar_entry e;
+  int r;
+  while (!(r = rh.next (e)))
+    if (!(e.flags & FRAR_PREVVOL) && !add (e))
+      break;
+  if (r != ERROR_EOF)
+    {
+      clear ();
+      return false;
+    }
+  if (enabled ())
+    save (arcpath);
+  return true;
+}
+
+/* Reads the file headers of the volume PATH into the index.  MORE
+   tells whether another volume follows. */
+bool
+header_index::scan_volume (const char *path, bool first, bool &more)
+{
+  rar_headers rh;
+  if (rh.open (path)
+      || ((rh.flags () & (UNRAR_ARC_VOLUME | UNRAR_ARC_ENCRYPTED_HEADERS))
+          != UNRAR_ARC_VOLUME)
+      || bool (rh.flags () & UNRAR_ARC_FIRSTVOLUME) != first)
+    return false;
+  rar_entry e;
+  int r;
+  while (!(r = rh.next (e)))
+    if (!add (e))
+      return false;
+  more = rh.more_volumes ();
+  return r == ERROR_EOF;
+}
+
+/* Appends the headers of the volume PART.  A file continued from the
+   previous volume is listed once, as UnRAR.DLL does, with the packed
+   sizes of all its parts and the CRC of the whole file from the last
+   one. */
+bool
+header_index::merge (const header_index &part)
+{
+  for (int j = 0; j < part.m_nrecs; j++)
+    {
+      DWORD flags = ((DWORD *)part.m_col[COL_FLAGS])[j];
+      if (flags & FRAR_PREVVOL)
+        {
+          int i = m_nrecs - 1;
+          if (i >= 0 && COLUMN (DWORD, COL_FLAGS)[i] & FRAR_NEXTVOL)
+            {
+              COLUMN (__int64, COL_PACK_SIZE)[i] += part.pack_size (j);
+              if (!(flags & FRAR_NEXTVOL))
+                COLUMN (DWORD, COL_CRC)[i] = ((DWORD *)part.m_col[COL_CRC])[j];
+            }
+          continue;
+        }
+      const char *name = part.name (j);
+      DWORD l = strlen (name) + 1;
+      int i = append (flags, l);
+      if (i < 0)
+        return false;
+      for (int c = 0; c < NCOLUMNS; c++)
+        memcpy ((char *)m_col[c] + col_width[c] * i,
+                (char *)part.m_col[c] + col_width[c] * j, col_width[c]);
+      COLUMN (DWORD, COL_NAME)[i] = m_pool_size;
+      memcpy (m_pool + m_pool_size, name, l);
+      m_pool_size += l;
+    }
+  return true;
+}
+
+/* A volume set whose volumes are read by several threads at once.
+   Each thread takes the next volume until there are none left. */
+struct volume_part
+{
+  char path[MAX_PATH];
+  header_index index;
+  bool ok;
+  bool more;
+};
+
+struct volume_scan
+{
+  volume_part *parts;
+  int count;
+  LONG next;
+};
+
+unsigned __stdcall
+header_index::scan_thread_proc (void *arg)
+{
+  volume_scan *s = (volume_scan *)arg;
+  for (LONG i; (i = InterlockedIncrement (&s->next)) < s->count;)
+    {
+      volume_part &v = s->parts[i];
+      v.ok = v.index.scan_volume (v.path, !i, v.more);
+    }
+  return 0;
+}
+
+/* Finds the volumes that follow FIRST by their names, and returns
+   them in *PATHS with FIRST itself.  The directory is read only once,
+   since each lookup may be a round trip to a file server. */
+static int
+find_volumes (const char *first, bool new_numbering, char (**paths)[MAX_PATH])
+{
+  char pattern[MAX_PATH + 2];
+  if (strlcpy (pattern, first, MAX_PATH) >= MAX_PATH)
+    return 0;
+  char *base = find_last_slash (pattern);
+  base = base ? base + 1 : pattern;
+  char *dot = strchr (base, '.');
+  strcpy (dot ? dot + 1 : base + strlen (base), "*");
+
+  path_set names;
+  WIN32_FIND_DATA fd;
+  HANDLE h = FindFirstFile (pattern, &fd);
+  if (h != INVALID_HANDLE_VALUE)
+    {
+      do
+        if (!(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            && !names.insert (fd.cFileName, strlen (fd.cFileName)))
+          break;
+      while (FindNextFile (h, &fd));
+      FindClose (h);
+    }
+
+  char (*v)[MAX_PATH] = 0;
+  int n = 0, max = 0;
+  for (;;)
+    {
+      if (n == max)
+        {
+          max = max ? max * 2 : 64;
+          char (*x)[MAX_PATH] = (char (*)[MAX_PATH])realloc (v, sizeof *v * max);
+          if (!x)
+            break;
+          v = x;
+        }
+      strcpy (v[n], n ? v[n - 1] : first);
+      if (n && !next_volume_name (v[n], new_numbering))
+        break;
+      const char *name = find_last_slash (v[n]);
+      name = name ? name + 1 : v[n];
+      if (n && !names.find (name, strlen (name)))
+        break;
+      if (++n == MAX_VOLUMES)
+        break;
+    }
+  *paths = v;
+  return n;
+}
+
+bool
+header_index::build_volumes (const char *arcpath, bool new_numbering)
+{
+  char (*paths)[MAX_PATH];
+  int n = find_volumes (arcpath, new_numbering, &paths);
+  volume_part *parts = n ? new volume_part[n] : 0;
+  if (!parts)
+    {
+      free (paths);
+      return false;
+    }
+  for (int i = 0; i < n; i++)
+    {
+      strcpy (parts[i].path, paths[i]);
+      parts[i].ok = parts[i].more = false;
+    }
+  free (paths);
+
+  /* The volumes are shared out among as many threads as there are
+     processors, as in UnrarCheckArchiveBatch.  Each one only maps a
+     window of the volume it reads, and needs little stack. */
+  volume_scan s;
+  s.parts = parts;
+  s.count = n;
+  s.next = -1;
+  HANDLE threads[MAXIMUM_WAIT_OBJECTS];
+  int nthreads = 0;
+  int max_threads = min (n, min (processor_count (),
+                                 int (MAXIMUM_WAIT_OBJECTS)));
+  if (max_threads > 1)
+    for (; nthreads < max_threads; nthreads++)
+      {
+        threads[nthreads] =
+          HANDLE (_beginthreadex (0, SCAN_STACK_SIZE, scan_thread_proc, &s,
+                                  STACK_SIZE_PARAM_IS_A_RESERVATION, 0));
+        if (!threads[nthreads])
+          break;
+      }
+  if (!nthreads)
+    scan_thread_proc (&s);
+  if (nthreads)
+    WaitForMultipleObjects (nthreads, threads, 1, INFINITE);
+  for (int i = 0; i < nthreads; i++)
+    CloseHandle (threads[i]);
+
+  /* The set ends with the first volume that says it is the last.
+     One that says otherwise with no volume after it is left to
+     UnRAR.DLL, which asks for the missing volume. */
+  m_cacheable = false;
+  bool ok = false;
+  for (int i = 0; i < n && parts[i].ok && merge (parts[i].index); i++)
+    if (!parts[i].more)
+      {
+        ok = true;
+        break;
+      }
+  delete [] parts;
+  if (!ok)
+    clear ();
+  return ok;
+}
+
+void
+header_index::get (int i, rarHeaderData &hd) const
+{
+  int64 u, p;
+  u.d = unp_size (i);
+  p.d = pack_size (i);
+  strlcpy (hd.FileName, name (i), sizeof hd.FileName);
+  *hd.FileNameW = 0;
+  hd.Flags = COLUMN (DWORD, COL_FLAGS)[i];
+  hd.PackSize = p.s.l;
+  hd.PackSizeHigh = p.s.h;
+  hd.UnpSize = u.s.l;
+  hd.UnpSizeHigh = u.s.h;
+  hd.HostOS = COLUMN (BYTE, COL_HOST_OS)[i];
+  hd.FileCRC = COLUMN (DWORD, COL_CRC)[i];
+  hd.FileTime = COLUMN (DWORD, COL_TIME)[i];
+  hd.UnpVer = COLUMN (BYTE, COL_UNP_VER)[i];
+  hd.Method = COLUMN (WORD, COL_METHOD)[i];
+  hd.FileAttr = COLUMN (DWORD, COL_ATTR)[i];
+}
+
+/* Gets the full path name of ARCPATH, its size and time stamp, and the
+   name of its index in the cache directory. */
+bool
+header_index::cache_name (const char *arcpath, char *name, char *fullpath,
+                          WIN32_FILE_ATTRIBUTE_DATA &fa)
+{
+  char *file;
+  DWORD l = GetFullPathName (arcpath, MAX_PATH + 1, fullpath, &file);
+  if (!l || l > MAX_PATH
+      || !GetFileAttributesEx (fullpath, GetFileExInfoStandard, &fa))
+    return false;
+
+  u_long h1 = 0, h2 = 0;
+  for (const u_char *p = (const u_char *)fullpath; *p; p++)
+    {
+      u_char c = translate (*p);
+      h1 = crc32 (h1, &c, 1);
+      h2 = h2 * 33 + c;
+    }
+
+  cs_lock lock (cache_lock);
+  if (!*cache_dir)
+    return false;
+  sprintf (name, "%s\\%08lx%08lx" INDEX_SUFFIX, cache_dir, h1, h2);
+  return true;
+}
+
+static bool
+read_fully (HANDLE h, void *buf, DWORD size)
+{
+  DWORD n;
+  return ReadFile (h, buf, size, &n, 0) && n == size;
+}
+
+static bool
+write_fully (HANDLE h, const void *buf, DWORD size)
+{
+  DWORD n;
+  return WriteFile (h, buf, size, &n, 0) && n == size;
+}
+
+bool
+header_index::read (HANDLE h, const char *fullpath,
+                    const WIN32_FILE_ATTRIBUTE_DATA &fa)
+{
+  index_header ih;
+  if (!read_fully (h, &ih, sizeof ih)
+      || memcmp (ih.magic, INDEX_MAGIC, sizeof ih.magic)
+      || ih.path_len > MAX_PATH
+      || ih.size != fa.nFileSizeLow
+      || ih.size_high != fa.nFileSizeHigh
+      || CompareFileTime (&ih.mtime, &fa.ftLastWriteTime)
+      || ih.nrecs > MAX_INDEX_RECORDS
+      || !ih.pool_size || ih.pool_size > MAX_INDEX_POOL
+      || (GetFileSize (h, 0)
+          != sizeof ih + ih.path_len + ih.nrecs * record_size () + ih.pool_size))
+    return false;
+
+  char path[MAX_PATH + 1];
+  if (!read_fully (h, path, ih.path_len))
+    return false;
+  path[ih.path_len] = 0;
+  if (_stricmp (path, fullpath))
+    return false;
+
+  /* The columns are saved one after another without gaps, which is
+     just how they are laid out when there is no room to spare. */
+  DWORD l = ih.nrecs * record_size ();
+  m_block = (char *)malloc (l + 1);
+  m_pool = (char *)malloc (ih.pool_size);
+  if (!m_block || !m_pool
+      || !read_fully (h, m_block, l)
+      || !read_fully (h, m_pool, ih.pool_size))
+    return false;
+  m_nrecs = m_maxrecs = ih.nrecs;
+  m_pool_size = m_pool_max = ih.pool_size;
+  layout (m_block, m_nrecs);
+
+  u_long crc = crc32 (0, path, ih.path_len);
+  crc = crc32 (crc, m_block, l);
+  crc = crc32 (crc, m_pool, m_pool_size);
+  if (crc != ih.crc || m_pool[m_pool_size - 1])
+    return false;
+  for (int i = 0; i < m_nrecs; i++)
+    if (COLUMN (DWORD, COL_NAME)[i] >= m_pool_size)
+      return false;
+  return true;
+}
+
+/* Loads the index of ARCPATH from the cache.  Fails if there is none,
+   or if the archive has changed since it was saved. */
+bool
+header_index::load (const char *arcpath)
+{
+  clear ();
+  char name[MAX_PATH * 2], fullpath[MAX_PATH + 1];
+  if (!cache_name (arcpath, name, fullpath, m_stamp))
+    return false;
+  m_stamped = true;
+
+  HANDLE h = CreateFile (name, GENERIC_READ | FILE_WRITE_ATTRIBUTES,
+                         FILE_SHARE_READ, 0, OPEN_EXISTING,
+                         FILE_FLAG_SEQUENTIAL_SCAN, 0);
+  if (h == INVALID_HANDLE_VALUE)
+    return false;
+  bool ok = read (h, fullpath, m_stamp);
+  if (ok)
+    {
+      /* The time stamp of an index is the time it was last used. */
+      FILETIME now;
+      GetSystemTimeAsFileTime (&now);
+      SetFileTime (h, 0, 0, &now);
+    }
+  CloseHandle (h);
+  if (!ok)
+    clear ();
+  return ok;
+}
+
+/* Saves the index of ARCPATH to the cache.  The archive's size and time
+   stamp are the ones seen by the last load, if any, so that an archive
+   changed while it was being listed is not taken for the old one. */
+bool
+header_index::save (const char *arcpath)
+{
+  if (!m_cacheable || !m_nrecs)
+    return false;
+
+  char name[MAX_PATH * 2], fullpath[MAX_PATH + 1];
+  WIN32_FILE_ATTRIBUTE_DATA fa;
+  if (!cache_name (arcpath, name, fullpath, fa))
+    return false;
+  if (m_stamped)
+    fa = m_stamp;
+
+  index_header ih;
+  memcpy (ih.magic, INDEX_MAGIC, sizeof ih.magic);
+  ih.path_len = strlen (fullpath);
+  ih.size = fa.nFileSizeLow;
+  ih.size_high = fa.nFileSizeHigh;
+  ih.mtime = fa.ftLastWriteTime;
+  ih.nrecs = m_nrecs;
+  ih.pool_size = m_pool_size;
+  ih.crc = crc32 (0, fullpath, ih.path_len);
+  for (int c = 0; c < NCOLUMNS; c++)
+    ih.crc = crc32 (ih.crc, m_col[c], col_width[c] * m_nrecs);
+  ih.crc = crc32 (ih.crc, m_pool, m_pool_size);
+
+  /* An index saved again replaces the old one in the running total. */
+  WIN32_FILE_ATTRIBUTE_DATA old;
+  DWORD old_size = (GetFileAttributesEx (name, GetFileExInfoStandard, &old)
+                    ? old.nFileSizeLow : 0);
+  HANDLE h = CreateFile (name, GENERIC_WRITE, 0, 0, CREATE_ALWAYS,
+                         FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, 0);
+  if (h == INVALID_HANDLE_VALUE)
+    return false;
+  DWORD size = sizeof ih + ih.path_len;
+  bool ok = (write_fully (h, &ih, sizeof ih)
+             && write_fully (h, fullpath, ih.path_len));
+  for (int c = 0; ok && c < NCOLUMNS; c++)
+    {
+      ok = write_fully (h, m_col[c], col_width[c] * m_nrecs);
+      size += col_width[c] * m_nrecs;
+    }
+  ok = ok && write_fully (h, m_pool, m_pool_size);
+  size += m_pool_size;
+  CloseHandle (h);
+  if (!ok)
+    {
+      DeleteFile (name);
+      size = 0;
+    }
+  {
+    cs_lock lock (cache_lock);
+    if (cache_total >= 0)
+      cache_total += (__int64)size - old_size;
+  }
+  if (!ok)
+    return false;
+  evict ();
+  return true;
+}
+
+struct cache_file
+{
+  FILETIME used;
+  DWORD size;
+  char name[MAX_PATH];
+};
+
+static int __cdecl
+compare_cache_file (const void *a, const void *b)
+{
+  return CompareFileTime (&((const cache_file *)a)->used,
+                          &((const cache_file *)b)->used);
+}
+
+/* Deletes the least recently used indexes until the cache fits in its
+   size limit.  The directory is only scanned the first time and when
+   the running total goes over the limit; other processes sharing the
+   cache are accounted for then. */
+void
+header_index::evict ()
+{
+  char dir[MAX_PATH + 1], buf[MAX_PATH * 2];
+  DWORD limit;
+  {
+    cs_lock lock (cache_lock);
+    if (cache_total >= 0 && cache_total <= cache_max)
+      return;
+    strcpy (dir, cache_dir);
+    limit = cache_max;
+  }
+  sprintf (buf, "%s\\*" INDEX_SUFFIX, dir);
+
+  WIN32_FIND_DATA fd;
+  HANDLE h = FindFirstFile (buf, &fd);
+  if (h == INVALID_HANDLE_VALUE)
+    {
+      cs_lock lock (cache_lock);
+      cache_total = 0;
+      return;
+    }
+  cache_file *files = 0;
+  int n = 0, maxn = 0;
+  __int64 total = 0;
+  bool complete = true;
+  do
+    {
+      if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        continue;
+      if (n == maxn)
+        {
+          maxn = maxn ? maxn * 2 : 64;
+          cache_file *x = (cache_file *)realloc (files, sizeof *x * maxn);
+          if (!x)
+            {
+              complete = false;
+              break;
+            }
+          files = x;
+        }
+      files[n].used = fd.ftLastWriteTime;
+      files[n].size = fd.nFileSizeLow;
+      strlcpy (files[n].name, fd.cFileName, sizeof files[n].name);
+      total += fd.nFileSizeLow;
+      n++;
+    }
+  while (FindNextFile (h, &fd));
+  FindClose (h);
+
+  if (total > limit)
+    {
+      qsort (files, n, sizeof *files, compare_cache_file);
+      for (int i = 0; i < n && total > limit; i++)
+        {
+          sprintf (buf, "%s\\%s", dir, files[i].name);
+          if (DeleteFile (buf))
+            total -= files[i].size;
+        }
+    }
+  free (files);
+  cs_lock lock (cache_lock);
+  cache_total = complete ? total : -1;
+}
@@ -0,0 +1,106 @@
+/*
+ *   Copyright (c) 1998-2004 T. Kamei (kamei@jsdlab.co.jp)
+ *
+ *   Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose is hereby granted provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies of the software and related documentation.
+ *
+ *                          NO WARRANTY
+ *
+ *   THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY WARRANTIES;
+ * WITHOUT EVEN THE IMPLIED WARRANTIES OF MERCHANTABILITY OR FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef _hdrindex_h_
+#define _hdrindex_h_
+
+struct rar_entry;
+
+/* The file headers of an archive, as listed by UnRAR.DLL.  Each field
+   is kept in a column of its own, and the names in a shared pool, so
+   that scanning the names does not drag the rest of the headers
+   through the cache.  An index built by a full listing can be saved in
+   the cache directory and loaded again as long as the archive's path,
+   size and time stamp are the same, so that listing it again does not
+   need UnRAR.DLL.  An archive whose headers are in the clear may also
+   be indexed by build without UnRAR.DLL at all; the volumes of a set
+   are then read at once by several threads and merged in order. */
+class header_index
+{
+public:
+  header_index ()
+       : m_block (0), m_nrecs (0), m_maxrecs (0),
+         m_pool (0), m_pool_size (0), m_pool_max (0), m_cacheable (true),
+         m_stamped (false)
+    {}
+  ~header_index ()
+    {clear ();}
+  void clear ();
+  int count () const
+    {return m_nrecs;}
+  const char *name (int i) const
+    {return m_pool + ((DWORD *)m_col[COL_NAME])[i];}
+  __int64 unp_size (int i) const
+    {return ((__int64 *)m_col[COL_UNP_SIZE])[i];}
+  __int64 pack_size (int i) const
+    {return ((__int64 *)m_col[COL_PACK_SIZE])[i];}
+  bool add (const rarHeaderData &hd);
+  bool add (const rar_entry &e);
+  void get (int i, rarHeaderData &hd) const;
+  bool load (const char *arcpath);
+  bool save (const char *arcpath);
+  bool build (const char *arcpath);
+  void uncacheable ()
+    {m_cacheable = false;}
+
+  static bool configure (const char *dir, DWORD max_size);
+  static bool enabled ();
+
+private:
+  enum
+    {
+      COL_UNP_SIZE,
+      COL_PACK_SIZE,
+      COL_NAME,
+      COL_CRC,
+      COL_TIME,
+      COL_ATTR,
+      COL_FLAGS,
+      COL_METHOD,
+      COL_HOST_OS,
+      COL_UNP_VER,
+      NCOLUMNS
+    };
+  static const int col_width[NCOLUMNS];
+
+  char *m_block;
+  void *m_col[NCOLUMNS];
+  int m_nrecs;
+  int m_maxrecs;
+  char *m_pool;
+  DWORD m_pool_size;
+  DWORD m_pool_max;
+  bool m_cacheable;
+  bool m_stamped;
+  WIN32_FILE_ATTRIBUTE_DATA m_stamp;
+
+  static DWORD record_size ();
+  void layout (char *block, int n);
+  bool reserve (int n);
+  int append (DWORD flags, DWORD name_max);
+  bool build_volumes (const char *arcpath, bool new_numbering);
+  bool scan_volume (const char *path, bool first, bool &more);
+  bool merge (const header_index &part);
+  static unsigned __stdcall scan_thread_proc (void *arg);
+  static bool cache_name (const char *arcpath, char *name, char *fullpath,
+                          WIN32_FILE_ATTRIBUTE_DATA &fa);
+  bool read (HANDLE h, const char *fullpath,
+             const WIN32_FILE_ATTRIBUTE_DATA &fa);
+  static void evict ();
+  void operator = (const header_index &);
+  header_index (const header_index &);
+};
+
+#endif /* _hdrindex_h_ */
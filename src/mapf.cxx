@@ -1,5 +1,5 @@
 /*
- *   Copyright (c) 1998-2002 T. Kamei (kamei@jsdlab.co.jp)
+ *   Copyright (c) 1998-2004 T. Kamei (kamei@jsdlab.co.jp)
  *
  *   Permission to use, copy, modify, and distribute this software
  * and its documentation for any purpose is hereby granted provided
@@ -14,39 +14,123 @@
  */
 
 #include <windows.h>
+#include "comm-arc.h"
+#include "util.h"
 #include "mapf.h"
 
+void
+mapf::init ()
+{
+  m_hf = INVALID_HANDLE_VALUE;
+  m_hm = 0;
+  m_base = 0;
+  m_size = 0;
+  m_copy = false;
+  m_win = 0;
+  m_win_off = 0;
+  m_win_len = 0;
+}
+
+void
+mapf::unmap_window ()
+{
+  if (m_win)
+    UnmapViewOfFile (m_win);
+  m_win = 0;
+  m_win_len = 0;
+}
+
 void
 mapf::close ()
 {
-  if (mf_base)
-    UnmapViewOfFile (mf_base);
-  if (mf_hm)
-    CloseHandle (mf_hm);
-  if (mf_hf != INVALID_HANDLE_VALUE)
-    CloseHandle (mf_hf);
+  unmap_window ();
+  if (m_base)
+    UnmapViewOfFile (m_base);
+  if (m_hm)
+    CloseHandle (m_hm);
+  if (m_hf != INVALID_HANDLE_VALUE)
+    CloseHandle (m_hf);
   init ();
 }
 
-int
-mapf::open (const char *path, int mode)
+bool
+mapf::open (const char *path, int mode, int flags)
 {
   close ();
-  mf_hf = CreateFile (path, GENERIC_READ, FILE_SHARE_READ, 0,
-                      OPEN_EXISTING, mode, 0);
-  if (mf_hf == INVALID_HANDLE_VALUE)
-    return 0;
+  m_hf = CreateFile (path, GENERIC_READ, FILE_SHARE_READ, 0,
+                     OPEN_EXISTING, mode, 0);
+  if (m_hf == INVALID_HANDLE_VALUE)
+    return false;
+
+  int64 size;
+  DWORD high;
+  size.s.l = GetFileSize (m_hf, &high);
+  if (size.s.l == 0xffffffff && GetLastError () != NO_ERROR)
+    return false;
+  size.s.h = high;
+  m_size = size.d;
+  m_copy = (flags & MAPF_COPY) != 0;
+  if (!m_size)
+    return true;
 
-  mf_size = GetFileSize (mf_hf, 0);
-  if (mf_size)
+  m_hm = CreateFileMapping (m_hf, 0, m_copy ? PAGE_WRITECOPY : PAGE_READONLY,
+                            0, 0, 0);
+  if (!m_hm)
+    return false;
+
+  if (flags & MAPF_WHOLE && m_size <= MAPF_WHOLE_MAX)
     {
-      mf_hm = CreateFileMapping (mf_hf, 0, PAGE_READONLY, 0, 0, 0);
-      if (!mf_hm)
-        return 0;
+      m_base = MapViewOfFile (m_hm, m_copy ? FILE_MAP_COPY : FILE_MAP_READ,
+                              0, 0, 0);
+      if (!m_base)
+        return false;
+    }
+  return true;
+}
+
+/* Returns the bytes at OFFSET, and in LEN how many of the LEN asked for
+   are there.  A file mapped whole is served from base (); otherwise a
+   window of at least MAPF_WINDOW bytes is mapped from the allocation
+   boundary below OFFSET, and replaces the previous one unless that
+   already covers the range. */
+const void *
+mapf::view (__int64 offset, DWORD &len)
+{
+  if (offset < 0 || offset >= m_size)
+    {
+      len = 0;
+      return 0;
+    }
+  if (m_size - offset < len)
+    len = DWORD (m_size - offset);
+  if (m_base)
+    return (const char *)m_base + offset;
 
-      mf_base = MapViewOfFile (mf_hm, FILE_MAP_READ, 0, 0, 0);
-      if (!mf_base)
-        return 0;
+  if (m_win && offset >= m_win_off
+      && offset - m_win_off + len <= m_win_len)
+    return m_win + (offset - m_win_off);
+
+  static DWORD granularity;
+  if (!granularity)
+    {
+      SYSTEM_INFO si;
+      GetSystemInfo (&si);
+      granularity = si.dwAllocationGranularity;
+    }
+
+  unmap_window ();
+  int64 start;
+  start.d = offset - offset % granularity;
+  __int64 l = max (offset - start.d + len,
+                   min ((__int64)MAPF_WINDOW, m_size - start.d));
+  m_win = (char *)MapViewOfFile (m_hm, m_copy ? FILE_MAP_COPY : FILE_MAP_READ,
+                                 start.s.h, start.s.l, DWORD (l));
+  if (!m_win)
+    {
+      len = 0;
+      return 0;
     }
-  return 1;
+  m_win_off = start.d;
+  m_win_len = DWORD (l);
+  return m_win + (offset - start.d);
 }
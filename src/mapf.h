@@ -16,6 +16,27 @@
 #ifndef _MAPF_H_
 # define _MAPF_H_
 
+/* A read-only file mapping.  With MAPF_WHOLE, files up to
+   MAPF_WHOLE_MAX bytes are mapped whole at open and seen through
+   base (); otherwise the file is only seen through view (), one
+   window of at least MAPF_WINDOW bytes at a time, so that reading a
+   few headers does not take up address space for the whole file.
+   MODE is the access hint passed to CreateFile,
+   FILE_FLAG_SEQUENTIAL_SCAN or FILE_FLAG_RANDOM_ACCESS.  With
+   MAPF_COPY, the views are copy-on-write: writes go to private pages
+   and never reach the file.
+
+   Reading a view raises EXCEPTION_IN_PAGE_ERROR when the file cannot
+   be read, as when the network to a remote file goes down.  Code that
+   walks a view catches it with __except (MAPF_FILTER). */
+#define MAPF_WHOLE_MAX (256 * 1024 * 1024)
+#define MAPF_WINDOW (1024 * 1024)
+#define MAPF_COPY 1
+#define MAPF_WHOLE 2
+#define MAPF_FILTER \
+  (GetExceptionCode () == EXCEPTION_IN_PAGE_ERROR \
+   ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH)
+
 class mapf
 {
 public:
@@ -23,56 +44,30 @@ public:
     {init ();}
   ~mapf ()
     {close ();}
-  bool open (const char *path, int mode = FILE_FLAG_SEQUENTIAL_SCAN)
-    {
-      close ();
-      m_hf = CreateFile (path, GENERIC_READ, FILE_SHARE_READ, 0,
-                         OPEN_EXISTING, mode, 0);
-      if (m_hf == INVALID_HANDLE_VALUE)
-        return false;
-
-      m_size = GetFileSize (m_hf, 0);
-      if (m_size)
-        {
-          m_hm = CreateFileMapping (m_hf, 0, PAGE_READONLY, 0, 0, 0);
-          if (!m_hm)
-            return false;
-
-          m_base = MapViewOfFile (m_hm, FILE_MAP_READ, 0, 0, 0);
-          if (!m_base)
-            return false;
-        }
-      return true;
-    }
-  void close ()
-    {
-      if (m_base)
-        UnmapViewOfFile (m_base);
-      if (m_hm)
-        CloseHandle (m_hm);
-      if (m_hf != INVALID_HANDLE_VALUE)
-        CloseHandle (m_hf);
-      init ();
-    }
+  bool open (const char *path, int mode = FILE_FLAG_SEQUENTIAL_SCAN,
+             int flags = 0);
+  void close ();
   const void *base () const
     {return m_base;}
-  DWORD size () const
+  __int64 size () const
     {return m_size;}
+  const void *view (__int64 offset, DWORD &len);
   operator HANDLE () const
     {return m_hf;}
 
 private:
   HANDLE m_hf;
   HANDLE m_hm;
-  DWORD m_size;
+  __int64 m_size;
   void *m_base;
+  bool m_copy;
+  char *m_win;
+  __int64 m_win_off;
+  DWORD m_win_len;
 
-  void init ()
-    {
-      m_hf = INVALID_HANDLE_VALUE;
-      m_hm = 0;
-      m_base = 0;
-      m_size = 0;
-    }
+  void init ();
+  void unmap_window ();
+  void operator = (const mapf &);
+  mapf (const mapf &);
 };
 #endif
@@ -16,12 +16,18 @@
 #include <windows.h>
 #include <mbstring.h>
 #include <stdio.h>
+#include <limits.h>
+#include <process.h>
 #include "comm-arc.h"
 #include "util.h"
 #include "unrarapi.h"
-#include "rar.h"
 #include "dialog.h"
+#include "rar.h"
+#include "hdrindex.h"
 #include "arcinfo.h"
+#include "mapf.h"
+#include "rarhdr.h"
+#include "unrar32.h"
 
 int
 UnRAR::open_err (int e) const
@@ -129,6 +135,7 @@ UnRAR::format (const char *fmt, ...) const
 {
   va_list ap;
   va_start (ap, fmt);
+  cs_lock lock (m_lock);
   int x = m_ostr.formatv (fmt, ap);
   va_end (ap);
   return x;
@@ -144,6 +151,7 @@ UnRAR::format (int id, ...) const
     {
       va_list ap;
       va_start (ap, id);
+      cs_lock lock (m_lock);
       int x = m_ostr.formatv (fmt, ap);
       va_end (ap);
       return x;
@@ -160,6 +168,11 @@ UnRAR::parse_opt (int ac, char **av)
   m_passwd = 0;
   m_path = 0;
   m_security_level = 2;
+  m_nthreads = 0;
+  m_wb_nbufs = WRITE_BEHIND_NBUFS;
+  m_wb_bufsize = WRITE_BEHIND_BUFSIZE;
+  m_cb_interval = CALLBACK_INTERVAL;
+  m_cb_delta = 0;
 
   if (!ac)
     {
@@ -269,6 +282,65 @@ UnRAR::parse_opt (int ac, char **av)
         m_opt |= O_NOT_ASK_PASSWORD;
         break;
 
+      case 'm':
+        if (av[i][2] != 't')
+          {
+            format (IDS_UNRECOGNIZED_OPTION, av[i][1]);
+            return ERROR_COMMAND_NAME;
+          }
+        m_nthreads = av[i][3] ? atoi (&av[i][3]) : processor_count ();
+        m_nthreads = max (1, min (m_nthreads, int (MAX_EXTRACT_THREADS)));
+        break;
+
+      case 'w':
+        if (av[i][2] != 'b')
+          {
+            format (IDS_UNRECOGNIZED_OPTION, av[i][1]);
+            return ERROR_COMMAND_NAME;
+          }
+        {
+          /* The whole ring is allocated at once, so its size is checked
+             as well as that of the buffers, before it can overflow a
+             32-bit SIZE_T. */
+          char *p;
+          m_wb_nbufs = strtol (&av[i][3], &p, 10);
+          if (*p == ',')
+            {
+              u_long kb = strtoul (p + 1, &p, 10);
+              m_wb_bufsize = (kb > WRITE_BEHIND_MAX_BUFSIZE / 1024
+                              ? WRITE_BEHIND_MAX_BUFSIZE + 1 : kb * 1024);
+            }
+          if (*p || m_wb_nbufs < 0 || m_wb_nbufs > WRITE_BEHIND_MAX_NBUFS
+              || m_wb_bufsize > WRITE_BEHIND_MAX_BUFSIZE
+              || (unsigned __int64)(m_wb_nbufs)
+                 * ((m_wb_bufsize + 0xffff) & ~0xffff)
+                 > WRITE_BEHIND_MAX_TOTAL)
+            {
+              format (IDS_UNRECOGNIZED_OPTION, av[i][1]);
+              return ERROR_COMMAND_NAME;
+            }
+        }
+        break;
+
+      case 'c':
+        if (av[i][2] != 'i')
+          {
+            format (IDS_UNRECOGNIZED_OPTION, av[i][1]);
+            return ERROR_COMMAND_NAME;
+          }
+        {
+          char *p;
+          m_cb_interval = strtoul (&av[i][3], &p, 10);
+          if (*p == ',')
+            m_cb_delta = strtoul (p + 1, &p, 10) * 1024;
+          if (*p || p == &av[i][3] || m_cb_interval > 60 * 1000)
+            {
+              format (IDS_UNRECOGNIZED_OPTION, av[i][1]);
+              return ERROR_COMMAND_NAME;
+            }
+        }
+        break;
+
       case '-':
         i++;
         goto optend;
@@ -278,6 +350,12 @@ UnRAR::parse_opt (int ac, char **av)
         return ERROR_COMMAND_NAME;
       }
 optend:
+  /* Testing writes nothing, so it uses every processor unless told
+     otherwise. */
+  if (!m_nthreads)
+    m_nthreads = (m_cmd == C_TEST
+                  ? min (processor_count (), int (MAX_EXTRACT_THREADS)) : 1);
+
   if (i >= ac)
     {
       format (IDS_NO_ARCHIVE_FILE);
@@ -299,7 +377,8 @@ optend:
         }
     }
 
-  m_glob.set_pattern (ac - i, av + i);
+  if (!m_glob.set_pattern (ac - i, av + i))
+    return ERROR_ENOUGH_MEMORY;
 
   return 0;
 }
@@ -316,6 +395,12 @@ public:
   operator HANDLE () const
     {return m_handle;}
   void attach (HANDLE h) {m_handle = h;}
+  HANDLE detach ()
+    {
+      HANDLE h = m_handle;
+      m_handle = INVALID_HANDLE_VALUE;
+      return h;
+    }
   void close ()
     {
       if (is_valid ())
@@ -330,9 +415,34 @@ private:
   HANDLE m_handle;
 };
 
+/* Same layout as FILE_BASIC_INFO and FILE_ALLOCATION_INFO, which
+   older SDKs do not have. */
+struct file_basic_info
+{
+  LARGE_INTEGER CreationTime;
+  LARGE_INTEGER LastAccessTime;
+  LARGE_INTEGER LastWriteTime;
+  LARGE_INTEGER ChangeTime;
+  DWORD FileAttributes;
+};
+#define FILE_BASIC_INFO_CLASS 0
+
+struct file_allocation_info
+{
+  LARGE_INTEGER AllocationSize;
+};
+#define FILE_ALLOCATION_INFO_CLASS 5
+
+typedef BOOL (WINAPI *SETFILEINFORMATIONBYHANDLE)(HANDLE, int, LPVOID, DWORD);
+static const SETFILEINFORMATIONBYHANDLE set_file_information_by_handle =
+  SETFILEINFORMATIONBYHANDLE (GetProcAddress (GetModuleHandle ("kernel32.dll"),
+                                              "SetFileInformationByHandle"));
+
 class write_handle: public dyn_handle
 {
 public:
+  enum {PREALLOC_THRESHOLD = 1024 * 1024};
+
   write_handle (const char *path)
        : m_complete (false), m_delete_if_fail (false), m_path (path)
     {}
@@ -347,9 +457,37 @@ public:
     }
   void complete ()
     {m_complete = true;}
-  bool ensure_room (LONG low, LONG high)
+  bool delete_if_fail () const
+    {return m_delete_if_fail;}
+  /* Reserves disk space for the whole file.  Small files are not
+     worth the extra calls.  Large ones get their clusters allocated
+     without moving the end of file where the file system supports
+     it, else the end of file is moved there and back. */
+  bool ensure_room (DWORD low, DWORD high)
     {
-      if ((SetFilePointer (*this, low, &high, FILE_BEGIN) == DWORD (~0)
+      if (!high && low < PREALLOC_THRESHOLD)
+        {
+          m_delete_if_fail = true;
+          return true;
+        }
+
+      if (set_file_information_by_handle)
+        {
+          file_allocation_info ai;
+          ai.AllocationSize.LowPart = low;
+          ai.AllocationSize.HighPart = high;
+          if (set_file_information_by_handle (*this, FILE_ALLOCATION_INFO_CLASS,
+                                              &ai, sizeof ai))
+            {
+              m_delete_if_fail = true;
+              return true;
+            }
+          if (GetLastError () == ERROR_DISK_FULL)
+            return false;
+        }
+
+      LONG h = high;
+      if ((SetFilePointer (*this, low, &h, FILE_BEGIN) == DWORD (~0)
            && GetLastError () != NO_ERROR)
           || !SetEndOfFile (*this))
         return false;
@@ -375,28 +513,547 @@ private:
   const char *m_path;
 };
 
+/* Copies the decompressed data into a ring of large buffers which a
+   separate thread writes out, so that decompression and disk I/O
+   overlap and small chunks reach the disk as large sequential writes.
+   The ring is the memory ceiling: when every buffer is waiting to be
+   written the decompressor blocks. */
+class write_behind
+{
+public:
+  write_behind ()
+       : m_mem (0), m_bufs (0), m_free (0), m_full (0), m_thread (0)
+    {}
+  ~write_behind ()
+    {close ();}
+  bool open (int nbufs, DWORD bufsize);
+  void close ();
+  bool is_open () const
+    {return m_thread != 0;}
+  bool write (HANDLE h, const u_char *data, DWORD nbytes);
+  bool flush ();
+
+private:
+  struct buffer
+    {
+      HANDLE h;
+      u_char *data;
+      DWORD size;
+    };
+  int m_nbufs;
+  DWORD m_bufsize;
+  u_char *m_mem;
+  buffer *m_bufs;
+  int m_head;
+  int m_tail;
+  bool m_holding;
+  HANDLE m_free;
+  HANDLE m_full;
+  HANDLE m_thread;
+  volatile LONG m_error;
+  volatile LONG m_quit;
+
+  void submit ();
+  void run ();
+  static unsigned __stdcall thread_proc (void *);
+  void operator = (const write_behind &);
+  write_behind (const write_behind &);
+};
+
+bool
+write_behind::open (int nbufs, DWORD bufsize)
+{
+  close ();
+  if (nbufs < 2 || !bufsize || bufsize > 0xffff0000)
+    return false;
+  m_nbufs = nbufs;
+  m_bufsize = (bufsize + 0xffff) & ~0xffff;
+  if ((unsigned __int64)(m_nbufs) * m_bufsize > SIZE_T (-1))
+    return false;
+  m_mem = (u_char *)VirtualAlloc (0, SIZE_T (m_nbufs) * m_bufsize,
+                                  MEM_COMMIT, PAGE_READWRITE);
+  m_bufs = new buffer[m_nbufs];
+  m_free = CreateSemaphore (0, m_nbufs, m_nbufs, 0);
+  m_full = CreateSemaphore (0, 0, m_nbufs + 1, 0);
+  if (!m_mem || !m_free || !m_full)
+    {
+      close ();
+      return false;
+    }
+  for (int i = 0; i < m_nbufs; i++)
+    m_bufs[i].data = m_mem + SIZE_T (i) * m_bufsize;
+  m_head = m_tail = 0;
+  m_holding = false;
+  m_error = 0;
+  m_quit = 0;
+  m_thread = HANDLE (_beginthreadex (0, 0, thread_proc, this, 0, 0));
+  if (!m_thread)
+    {
+      close ();
+      return false;
+    }
+  return true;
+}
+
+void
+write_behind::close ()
+{
+  if (m_thread)
+    {
+      flush ();
+      InterlockedExchange (&m_quit, 1);
+      ReleaseSemaphore (m_full, 1, 0);
+      WaitForSingleObject (m_thread, INFINITE);
+      CloseHandle (m_thread);
+      m_thread = 0;
+    }
+  if (m_free)
+    CloseHandle (m_free);
+  if (m_full)
+    CloseHandle (m_full);
+  m_free = m_full = 0;
+  if (m_mem)
+    VirtualFree (m_mem, 0, MEM_RELEASE);
+  m_mem = 0;
+  delete [] m_bufs;
+  m_bufs = 0;
+}
+
+void
+write_behind::submit ()
+{
+  m_holding = false;
+  m_head = (m_head + 1) % m_nbufs;
+  ReleaseSemaphore (m_full, 1, 0);
+}
+
+/* Returns false once a write has failed; the caller should stop
+   feeding data and call flush to collect the error. */
+bool
+write_behind::write (HANDLE h, const u_char *data, DWORD nbytes)
+{
+  while (nbytes)
+    {
+      if (m_error)
+        return false;
+      buffer &b = m_bufs[m_head];
+      if (!m_holding)
+        {
+          WaitForSingleObject (m_free, INFINITE);
+          m_holding = true;
+          b.h = h;
+          b.size = 0;
+        }
+      else if (b.h != h)
+        {
+          submit ();
+          continue;
+        }
+      DWORD n = min (nbytes, m_bufsize - b.size);
+      memcpy (b.data + b.size, data, n);
+      b.size += n;
+      data += n;
+      nbytes -= n;
+      if (b.size == m_bufsize)
+        submit ();
+    }
+  return !m_error;
+}
+
+/* Waits until everything queued so far is on disk.  Returns false if
+   any write failed since the last flush. */
+bool
+write_behind::flush ()
+{
+  if (!m_thread)
+    return true;
+  if (m_holding)
+    submit ();
+  int i;
+  for (i = 0; i < m_nbufs; i++)
+    WaitForSingleObject (m_free, INFINITE);
+  ReleaseSemaphore (m_free, m_nbufs, 0);
+  return !InterlockedExchange (&m_error, 0);
+}
+
+void
+write_behind::run ()
+{
+  for (;;)
+    {
+      WaitForSingleObject (m_full, INFINITE);
+      if (m_quit)
+        break;
+      buffer &b = m_bufs[m_tail];
+      DWORD nwritten;
+      if (!m_error && b.size
+          && (!WriteFile (b.h, b.data, b.size, &nwritten, 0)
+              || nwritten != b.size))
+        InterlockedExchange (&m_error, 1);
+      m_tail = (m_tail + 1) % m_nbufs;
+      ReleaseSemaphore (m_free, 1, 0);
+    }
+}
+
+unsigned __stdcall
+write_behind::thread_proc (void *arg)
+{
+  ((write_behind *)arg)->run ();
+  return 0;
+}
+
+/* Takes over the handles of extracted files and sets their end of
+   file, time stamp and attributes on a separate thread before closing
+   them, so that the decompressor can go straight on with the next
+   entry. */
+class file_finisher
+{
+public:
+  file_finisher (const UnRAR &unrar)
+       : m_unrar (unrar), m_jobs (0), m_free (0), m_full (0), m_thread (0),
+         m_nerrors (0)
+    {}
+  ~file_finisher ()
+    {close ();}
+  bool open ();
+  void close ();
+  void finish (HANDLE h, const char *path, const rarHeaderData &hd,
+               bool delete_if_fail);
+  void drain ();
+  int nerrors () const
+    {return m_nerrors;}
+
+private:
+  enum {NJOBS = 64};
+  struct job
+    {
+      HANDLE h;
+      DWORD time;
+      DWORD attr;
+      bool delete_if_fail;
+      char path[FNAME_MAX32 + FRAR_PATH_MAX + 1];
+    };
+  const UnRAR &m_unrar;
+  job *m_jobs;
+  int m_head;
+  int m_tail;
+  HANDLE m_free;
+  HANDLE m_full;
+  HANDLE m_thread;
+  volatile LONG m_quit;
+  volatile LONG m_nerrors;
+
+  void apply (job &j);
+  void run ();
+  static unsigned __stdcall thread_proc (void *);
+  void operator = (const file_finisher &);
+  file_finisher (const file_finisher &);
+};
+
+bool
+file_finisher::open ()
+{
+  close ();
+  m_jobs = new job[NJOBS];
+  m_free = CreateSemaphore (0, NJOBS, NJOBS, 0);
+  m_full = CreateSemaphore (0, 0, NJOBS + 1, 0);
+  if (!m_free || !m_full)
+    {
+      close ();
+      return false;
+    }
+  m_head = m_tail = 0;
+  m_quit = 0;
+  m_thread = HANDLE (_beginthreadex (0, 0, thread_proc, this, 0, 0));
+  if (!m_thread)
+    {
+      close ();
+      return false;
+    }
+  return true;
+}
+
+void
+file_finisher::close ()
+{
+  if (m_thread)
+    {
+      drain ();
+      InterlockedExchange (&m_quit, 1);
+      ReleaseSemaphore (m_full, 1, 0);
+      WaitForSingleObject (m_thread, INFINITE);
+      CloseHandle (m_thread);
+      m_thread = 0;
+    }
+  if (m_free)
+    CloseHandle (m_free);
+  if (m_full)
+    CloseHandle (m_full);
+  m_free = m_full = 0;
+  delete [] m_jobs;
+  m_jobs = 0;
+}
+
+void
+file_finisher::finish (HANDLE h, const char *path, const rarHeaderData &hd,
+                       bool delete_if_fail)
+{
+  job tmp;
+  job &j = m_thread ? m_jobs[m_head] : tmp;
+  if (m_thread)
+    WaitForSingleObject (m_free, INFINITE);
+  j.h = h;
+  j.time = hd.FileTime;
+  j.attr = hd.FileAttr;
+  j.delete_if_fail = delete_if_fail;
+  strcpy (j.path, path);
+  if (!m_thread)
+    apply (j);
+  else
+    {
+      m_head = (m_head + 1) % NJOBS;
+      ReleaseSemaphore (m_full, 1, 0);
+    }
+}
+
+/* Waits until every file handed over so far is closed. */
+void
+file_finisher::drain ()
+{
+  if (!m_thread)
+    return;
+  for (int i = 0; i < NJOBS; i++)
+    WaitForSingleObject (m_free, INFINITE);
+  ReleaseSemaphore (m_free, NJOBS, 0);
+}
+
+void
+file_finisher::apply (job &j)
+{
+  if (!SetEndOfFile (j.h))
+    {
+      m_unrar.format (IDS_CANNOT_SET_EOF);
+      CloseHandle (j.h);
+      if (j.delete_if_fail)
+        DeleteFile (j.path);
+      InterlockedIncrement (&m_nerrors);
+      return;
+    }
+
+  FILETIME lo, ft;
+  DosDateTimeToFileTime (j.time >> 16, j.time, &lo);
+  LocalFileTimeToFileTime (&lo, &ft);
+
+  bool done = false;
+  if (set_file_information_by_handle)
+    {
+      file_basic_info bi;
+      memset (&bi, 0, sizeof bi);
+      bi.LastWriteTime.LowPart = ft.dwLowDateTime;
+      bi.LastWriteTime.HighPart = ft.dwHighDateTime;
+      bi.FileAttributes = j.attr ? j.attr : FILE_ATTRIBUTE_NORMAL;
+      done = set_file_information_by_handle (j.h, FILE_BASIC_INFO_CLASS,
+                                             &bi, sizeof bi) != 0;
+    }
+  if (!done)
+    SetFileTime (j.h, 0, 0, &ft);
+  CloseHandle (j.h);
+  if (!done)
+    SetFileAttributes (j.path, j.attr);
+}
+
+void
+file_finisher::run ()
+{
+  for (;;)
+    {
+      WaitForSingleObject (m_full, INFINITE);
+      if (m_quit)
+        break;
+      apply (m_jobs[m_tail]);
+      m_tail = (m_tail + 1) % NJOBS;
+      ReleaseSemaphore (m_free, 1, 0);
+    }
+}
+
+unsigned __stdcall
+file_finisher::thread_proc (void *arg)
+{
+  ((file_finisher *)arg)->run ();
+  return 0;
+}
+
+static DWORD
+dos_file_time (const FILETIME &ft)
+{
+  FILETIME lo;
+  FileTimeToLocalFileTime (&ft, &lo);
+  WORD d, t;
+  FileTimeToDosDateTime (&lo, &d, &t);
+  return (DWORD (d) << 16) + t;
+}
+
+/* Returns the state of DIR (L bytes long, without a trailing slash),
+   reading it first if this is the first time it is asked for. */
 int
-UnRAR::check_timestamp (const char *path, const rarHeaderData &hd)
+dest_snapshot::scan (const char *dir, size_t l)
 {
+  int *state = (int *)m_dirs.insert (dir, l);
+  if (!state)
+    return DIR_UNKNOWN;
+  if (*state)
+    return *state;
+
+  char buf[FNAME_MAX32 + FRAR_PATH_MAX + 1];
+  if (l + 2 >= sizeof buf)
+    return *state = DIR_UNKNOWN;
+  memcpy (buf, dir, l);
+  strcpy (buf + l, "\\*");
+
   WIN32_FIND_DATA fd;
-  HANDLE h = FindFirstFile (path, &fd);
-  if (h != INVALID_HANDLE_VALUE)
-    FindClose (h);
+  HANDLE h = FindFirstFile (buf, &fd);
+  if (h == INVALID_HANDLE_VALUE)
+    {
+      DWORD e = GetLastError ();
+      return *state = (e == ERROR_FILE_NOT_FOUND || e == ERROR_PATH_NOT_FOUND
+                       ? DIR_SCANNED : DIR_UNKNOWN);
+    }
+  do
+    {
+      if (!strcmp (fd.cFileName, ".") || !strcmp (fd.cFileName, ".."))
+        continue;
+      file_info fi;
+      fi.time = dos_file_time (fd.ftLastWriteTime);
+      fi.size.s.l = fd.nFileSizeLow;
+      fi.size.s.h = fd.nFileSizeHigh;
+      for (int i = 0; i < 2; i++)
+        {
+          const char *name = i ? fd.cAlternateFileName : fd.cFileName;
+          if (!*name || l + 1 + strlen (name) >= sizeof buf)
+            continue;
+          strcpy (buf + l + 1, name);
+          file_info *p = (file_info *)m_files.insert (buf, strlen (buf));
+          if (!p)
+            {
+              FindClose (h);
+              return *state = DIR_UNKNOWN;
+            }
+          *p = fi;
+        }
+    }
+  while (FindNextFile (h, &fd));
+  FindClose (h);
+  return *state = DIR_SCANNED;
+}
+
+/* Tells whether a name missing from the snapshot is missing from the
+   disk too.  path_set only folds ASCII letters, whereas the file
+   system also folds other letters and drops trailing dots and spaces,
+   so other names have to be looked up there. */
+static bool
+trust_miss (const char *name)
+{
+  const u_char *s = (const u_char *)name;
+  if (!*s)
+    return false;
+  for (; *s; s++)
+    if (*s >= 0x80)
+      return false;
+  return s[-1] != '.' && s[-1] != ' ';
+}
+
+/* Returns 1 and fills FI if PATH exists, 0 if it does not, or -1 if
+   the snapshot cannot tell. */
+int
+dest_snapshot::lookup (const char *path, file_info &fi)
+{
+  if (strpbrk (path, "*?"))
+    return -1;
+  const char *sl = find_last_slash (path);
+  if (!sl)
+    return -1;
+
+  cs_lock lock (m_lock);
+  if (scan (path, sl - path) != DIR_SCANNED)
+    return -1;
+  const file_info *p = (const file_info *)m_files.find (path, strlen (path));
+  if (!p)
+    return trust_miss (sl + 1) ? 0 : -1;
+  fi = *p;
+  return 1;
+}
+
+/* A directory that was just created is known to be empty. */
+void
+dest_snapshot::created_dir (const char *path, size_t l)
+{
+  cs_lock lock (m_lock);
+  int *state = (int *)m_dirs.insert (path, l);
+  if (state && !*state)
+    *state = DIR_SCANNED;
+}
+
+void
+dest_snapshot::update (const char *path, const rarHeaderData &hd)
+{
+  const char *sl = find_last_slash (path);
+  if (!sl)
+    return;
+
+  cs_lock lock (m_lock);
+  int *state = (int *)m_dirs.find (path, sl - path);
+  if (!state || *state != DIR_SCANNED)
+    return;
+  file_info *p = (file_info *)m_files.insert (path, strlen (path));
+  if (!p)
+    {
+      *state = DIR_UNKNOWN;
+      return;
+    }
+  p->time = hd.FileTime;
+  p->size.s.l = hd.UnpSize;
+  p->size.s.h = hd.UnpSizeHigh;
+}
+
+void
+dest_snapshot::clear ()
+{
+  cs_lock lock (m_lock);
+  m_dirs.clear ();
+  m_files.clear ();
+}
+
+int
+UnRAR::check_timestamp (const char *path, const rarHeaderData &hd)
+{
+  if (m_type == UT_OVWRT)
+    return 1;
+
+  dest_snapshot::file_info fi;
+  int exists = m_snap.lookup (path, fi);
+  if (exists < 0)
+    {
+      WIN32_FIND_DATA fd;
+      HANDLE h = FindFirstFile (path, &fd);
+      exists = h != INVALID_HANDLE_VALUE;
+      if (exists)
+        {
+          FindClose (h);
+          fi.time = dos_file_time (fd.ftLastWriteTime);
+          fi.size.s.l = fd.nFileSizeLow;
+          fi.size.s.h = fd.nFileSizeHigh;
+        }
+    }
 
   switch (m_type)
     {
     case UT_ASK:
-      if (h != INVALID_HANDLE_VALUE && !(m_opt & O_YES))
+      if (exists && !(m_opt & O_YES))
         {
           replace_param r;
           r.name = path;
-          FILETIME ft;
-          FileTimeToLocalFileTime (&fd.ftLastWriteTime, &ft);
-          WORD d, t;
-          FileTimeToDosDateTime (&ft, &d, &t);
-          r.old_date = (DWORD (d) << 16) + t;
-          r.old_size.s.l = fd.nFileSizeLow;
-          r.old_size.s.h = fd.nFileSizeHigh;
+          r.old_date = fi.time;
+          r.old_size = fi.size;
           r.new_date = hd.FileTime;
           r.new_size.s.l = hd.UnpSize;
           r.new_size.s.h = hd.UnpSizeHigh;
@@ -415,26 +1072,16 @@ UnRAR::check_timestamp (const char *path, const rarHeaderData &hd)
         }
       break;
 
-    case UT_OVWRT:
-      return 1;
-
     case UT_SKIP:
-      return h == INVALID_HANDLE_VALUE;
+      return !exists;
 
     case UT_EXISTING:
-      if (h == INVALID_HANDLE_VALUE)
+      if (!exists)
         return 0;
       /* fall thru... */
     case UT_NEWER:
-      if (h != INVALID_HANDLE_VALUE)
-        {
-          FILETIME ft;
-          FileTimeToLocalFileTime (&fd.ftLastWriteTime, &ft);
-          WORD d, t;
-          FileTimeToDosDateTime (&ft, &d, &t);
-          if ((DWORD (d) << 16) + t >= hd.FileTime)
-            return 0;
-        }
+      if (exists && fi.time >= hd.FileTime)
+        return 0;
       break;
     }
   return 1;
@@ -451,87 +1098,383 @@ struct extract_info
   bool error;
   int64 nbytes;
   EXTRACTINGINFOEX *xex;
+  const volatile LONG *cancel;
+  volatile __int64 *done;
+  write_behind *wb;
+  class event_notifier *notify;
+  u_char *mem;
+  DWORD mem_size;
+  ostrbuf *ostr;
+  bool full;
+  bool discard;
+};
+
+struct extract_thread
+{
+  UnRAR *unrar;
+  HANDLE h;
+  progress_dlg *progress;
+  write_behind *wb;
+  file_finisher *fin;
+  EXTRACTINGINFOEX *xex;
+  EXTRACTINGINFOEX ex;
+  volatile __int64 done;
+  int nerrors;
+  int err;
+  int err_index;
 };
 
-static extract_info *xtract_info;
 static const UINT UWM_ARCEXTRACT = RegisterWindowMessage (WM_ARCEXTRACT);
 
-static LONG_PTR
-run_callback (int mode, EXTRACTINGINFOEX &ex)
+/* Delivers ARCEXTRACT events to the host.  Progress events are
+   coalesced and sent from a separate thread, at most once every
+   INTERVAL milliseconds or as soon as DELTA more bytes have been
+   written, so that a slow host does not hold up the decompressor.
+   Other events are sent synchronously after any progress still
+   pending, so the host sees them in order.  A cancel returned from a
+   progress event is picked up by the next write. */
+class event_notifier
+{
+public:
+  event_notifier ()
+       : m_mutex (0), m_wake (0), m_thread (0), m_canceled (0),
+         m_sending (0)
+    {m_host.has_callback = false;}
+  ~event_notifier ()
+    {close ();}
+  void open (const owner_info &host, DWORD interval, DWORD delta);
+  void close ();
+  bool send (int mode, EXTRACTINGINFOEX &ex);
+  bool progress (const EXTRACTINGINFOEX &ex, DWORD nbytes);
+
+private:
+  owner_info m_host;
+  critical_section m_lock;
+  critical_section m_call_lock;
+  EXTRACTINGINFOEX m_ex;
+  EXTRACTINGINFOEX m_out;
+  const EXTRACTINGINFOEX *m_src;
+  bool m_pending;
+  DWORD m_accum;
+  DWORD m_last;
+  DWORD m_interval;
+  DWORD m_delta;
+  DWORD m_owner;
+  HANDLE m_mutex;
+  HANDLE m_wake;
+  HANDLE m_thread;
+  volatile LONG m_quit;
+  volatile LONG m_canceled;
+  volatile LONG m_sending;
+
+  LONG_PTR call (int mode, EXTRACTINGINFOEX &ex);
+  void acquire ();
+  void release ();
+  void flush ();
+  DWORD due ();
+  void run ();
+  static unsigned __stdcall thread_proc (void *);
+  void operator = (const event_notifier &);
+  event_notifier (const event_notifier &);
+};
+
+void
+event_notifier::open (const owner_info &host, DWORD interval, DWORD delta)
+{
+  close ();
+  m_host = host;
+  m_interval = interval;
+  m_delta = delta;
+  m_pending = false;
+  m_src = 0;
+  m_accum = 0;
+  m_last = GetTickCount ();
+  m_owner = GetCurrentThreadId ();
+  m_quit = 0;
+  m_canceled = 0;
+  if (!interval)
+    return;
+  m_mutex = CreateMutex (0, FALSE, 0);
+  m_wake = CreateEvent (0, FALSE, FALSE, 0);
+  if (m_mutex && m_wake)
+    m_thread = HANDLE (_beginthreadex (0, 0, thread_proc, this, 0, 0));
+  if (!m_thread)
+    {
+      close ();
+      m_interval = 0;
+    }
+}
+
+void
+event_notifier::close ()
 {
-  return (lstate.has_callback
-          ? (lstate.callback
-             ? !lstate.callback (lstate.hwnd_owner, UWM_ARCEXTRACT,
-                                 mode, &ex)
-             : SendMessage (lstate.hwnd_owner, UWM_ARCEXTRACT,
-                            mode, LPARAM (&ex)))
-          : 0);
+  if (m_thread)
+    {
+      acquire ();
+      flush ();
+      release ();
+      InterlockedExchange (&m_quit, 1);
+      SetEvent (m_wake);
+      WaitForSingleObject (m_thread, INFINITE);
+      CloseHandle (m_thread);
+      m_thread = 0;
+    }
+  if (m_wake)
+    CloseHandle (m_wake);
+  if (m_mutex)
+    CloseHandle (m_mutex);
+  m_wake = m_mutex = 0;
 }
 
-static int __cdecl
-extract_helper (void *, u_char *data, int nbytes)
+LONG_PTR
+event_notifier::call (int mode, EXTRACTINGINFOEX &ex)
 {
-  if (!xtract_info)
-    return 1;
+  if (m_host.callback)
+    return !m_host.callback (m_host.hwnd_owner, UWM_ARCEXTRACT, mode, &ex);
+  InterlockedExchange (&m_sending, 1);
+  LONG_PTR r = SendMessage (m_host.hwnd_owner, UWM_ARCEXTRACT,
+                            mode, LPARAM (&ex));
+  InterlockedExchange (&m_sending, 0);
+  return r;
+}
 
-  DWORD nwritten;
-  if (!WriteFile (xtract_info->h, data, nbytes, &nwritten, 0)
-      || nwritten != DWORD (nbytes))
+/* Serializes calls to the host.  The thread that owns the host's
+   window keeps answering messages sent from the notifier thread while
+   it waits, or the two would wait for each other. */
+void
+event_notifier::acquire ()
+{
+  if (!m_thread)
+    m_call_lock.lock ();
+  else if (GetCurrentThreadId () != m_owner)
+    WaitForSingleObject (m_mutex, INFINITE);
+  else
     {
-      xtract_info->error = true;
-      xtract_info = 0;
-      return 0;
+      MSG msg;
+      while (MsgWaitForMultipleObjects (1, &m_mutex, FALSE, INFINITE,
+                                        QS_SENDMESSAGE) == WAIT_OBJECT_0 + 1)
+        PeekMessage (&msg, 0, 0, 0, PM_NOREMOVE);
     }
+}
+
+void
+event_notifier::release ()
+{
+  if (!m_thread)
+    m_call_lock.unlock ();
+  else
+    ReleaseMutex (m_mutex);
+}
+
+/* Sends the pending progress event, if any.  Must be called between
+   acquire and release. */
+void
+event_notifier::flush ()
+{
+  {
+    cs_lock lock (m_lock);
+    if (!m_pending)
+      return;
+    m_out = m_ex;
+    m_pending = false;
+    m_accum = 0;
+    m_last = GetTickCount ();
+  }
+  if (call (ARCEXTRACT_INPROCESS, m_out))
+    InterlockedExchange (&m_canceled, 1);
+}
+
+bool
+event_notifier::send (int mode, EXTRACTINGINFOEX &ex)
+{
+  if (!m_host.has_callback)
+    return false;
+  acquire ();
+  flush ();
+  if (call (mode, ex))
+    InterlockedExchange (&m_canceled, 1);
+  release ();
+  return m_canceled != 0;
+}
 
-  xtract_info->nbytes.d += nbytes;
-  if (xtract_info->progress
-      && !xtract_info->progress->update (xtract_info->nbytes))
+bool
+event_notifier::progress (const EXTRACTINGINFOEX &ex, DWORD nbytes)
+{
+  if (!m_host.has_callback)
+    return false;
+  if (!m_thread)
+    return send (ARCEXTRACT_INPROCESS, const_cast <EXTRACTINGINFOEX &> (ex));
+
+  bool wake;
+  {
+    cs_lock lock (m_lock);
+    wake = !m_pending;
+    if (!m_pending || m_src != &ex)
+      m_ex = ex;
+    else
+      m_ex.exinfo.dwWriteSize = ex.exinfo.dwWriteSize;
+    m_src = &ex;
+    m_pending = true;
+    if (m_delta && m_accum < m_delta && m_accum + nbytes >= m_delta)
+      wake = true;
+    m_accum += nbytes;
+  }
+  if (wake)
+    SetEvent (m_wake);
+
+  if (m_sending && GetCurrentThreadId () == m_owner)
     {
-      xtract_info->canceled = true;
-      xtract_info = 0;
-      return 0;
+      MSG msg;
+      PeekMessage (&msg, 0, 0, 0, PM_NOREMOVE);
     }
-  if (lstate.has_callback)
+  return m_canceled != 0;
+}
+
+/* Returns how long the notifier thread may sleep before the pending
+   progress event is due. */
+DWORD
+event_notifier::due ()
+{
+  cs_lock lock (m_lock);
+  if (!m_pending)
+    return INFINITE;
+  if (m_delta && m_accum >= m_delta)
+    return 0;
+  DWORD elapsed = GetTickCount () - m_last;
+  return elapsed >= m_interval ? 0 : m_interval - elapsed;
+}
+
+void
+event_notifier::run ()
+{
+  for (;;)
     {
-      xtract_info->xex->exinfo.dwWriteSize =
-        !xtract_info->nbytes.s.h ? xtract_info->nbytes.s.l : -1;
-      if (run_callback (ARCEXTRACT_INPROCESS, *xtract_info->xex))
+      DWORD wait = due ();
+      if (!wait)
         {
-          xtract_info->canceled = true;
-          xtract_info = 0;
-          return 0;
+          WaitForSingleObject (m_mutex, INFINITE);
+          flush ();
+          ReleaseMutex (m_mutex);
+          continue;
         }
+      WaitForSingleObject (m_wake, wait);
+      if (m_quit)
+        break;
     }
+}
 
-  return 1;
+unsigned __stdcall
+event_notifier::thread_proc (void *arg)
+{
+  ((event_notifier *)arg)->run ();
+  return 0;
 }
 
 static int __cdecl
-change_volume (void *, char *path, int mode)
+extract_helper (rarData *rd, u_char *data, int nbytes)
 {
-  if (mode != RAR_VOL_ASK)
+  extract_info *xinfo = rd ? (extract_info *)rd->pExtractInfo : 0;
+  if (!xinfo)
     return 1;
-  return change_vol_dialog (xtract_info ? xtract_info->hwnd_owner : 0, path);
-}
 
-int CALLBACK rar_event_handler(UINT msg,LPARAM UserData,LPARAM P1,LPARAM P2)
-{
-  switch(msg)
+  if (xinfo->ostr)
     {
-    case UCM_CHANGEVOLUME:
-      return change_volume(NULL,(char*)P1,(int)P2);
+      if (!xinfo->ostr->write ((const char *)data, nbytes))
+        {
+          xinfo->full = true;
+          rd->pExtractInfo = 0;
+          return 0;
+        }
+      return 1;
+    }
+
+  if (xinfo->mem)
+    {
+      DWORD n = min (DWORD (nbytes), xinfo->mem_size);
+      memcpy (xinfo->mem, data, n);
+      xinfo->mem += n;
+      xinfo->mem_size -= n;
+      xinfo->nbytes.d += n;
+      int64 unp;
+      unp.s.l = xinfo->hd->UnpSize;
+      unp.s.h = xinfo->hd->UnpSizeHigh;
+      if (n < DWORD (nbytes) || (!xinfo->mem_size && xinfo->nbytes.d < unp.d))
+        {
+          /* The buffer is full; no point in decompressing the rest. */
+          xinfo->full = true;
+          rd->pExtractInfo = 0;
+          return 0;
+        }
+      return 1;
+    }
+
+  DWORD nwritten;
+  if (!xinfo->discard
+      && (xinfo->wb
+          ? !xinfo->wb->write (xinfo->h, data, nbytes)
+          : (!WriteFile (xinfo->h, data, nbytes, &nwritten, 0)
+             || nwritten != DWORD (nbytes))))
+    {
+      xinfo->error = true;
+      rd->pExtractInfo = 0;
+      return 0;
+    }
+
+  xinfo->nbytes.d += nbytes;
+  if (xinfo->done)
+    *xinfo->done += nbytes;
+  if ((xinfo->progress
+       && !xinfo->progress->update (xinfo->nbytes))
+      || (xinfo->cancel && *xinfo->cancel))
+    {
+      xinfo->canceled = true;
+      rd->pExtractInfo = 0;
+      return 0;
+    }
+  if (xinfo->notify)
+    {
+      xinfo->xex->exinfo.dwWriteSize =
+        !xinfo->nbytes.s.h ? xinfo->nbytes.s.l : -1;
+      if (xinfo->notify->progress (*xinfo->xex, nbytes))
+        {
+          xinfo->canceled = true;
+          rd->pExtractInfo = 0;
+          return 0;
+        }
+    }
+
+  return 1;
+}
+
+static int __cdecl
+change_volume (rarData *rd, char *path, int mode)
+{
+  if (mode != RAR_VOL_ASK)
+    return 1;
+  extract_info *xinfo = rd ? (extract_info *)rd->pExtractInfo : 0;
+  return change_vol_dialog (xinfo ? xinfo->hwnd_owner : 0, path);
+}
+
+int CALLBACK rar_event_handler(UINT msg,LPARAM UserData,LPARAM P1,LPARAM P2)
+{
+  switch(msg)
+    {
+    case UCM_CHANGEVOLUME:
+      return change_volume((rarData*)UserData,(char*)P1,(int)P2);
     case UCM_PROCESSDATA:
-      return extract_helper(NULL,(u_char*)P1,(int)P2);
+      return extract_helper((rarData*)UserData,(u_char*)P1,(int)P2);
     case UCM_NEEDPASSWORD:
       {
         const char* pwd=NULL;
         rarData* prd=(rarData*)UserData;
         if(!prd)return -1;
+        prd->asked_password=true;
+        char buf[PASSWD_MAX];
         if(prd->can_ask_password){
           if(prd->pUserData){
             pwd=((UnRAR*)prd->pUserData)->get_password();
           }else{
-            pwd=askpass_dialog (0);
+            pwd=askpass_dialog (0, buf);
           }
         }
         if(pwd){
@@ -560,8 +1503,10 @@ int CALLBACK rar_openarc_handler(UINT msg,LPARAM UserData,LPARAM P1,LPARAM P2)
         const char* pwd=NULL;
         arcinfo* pInfo=(arcinfo*)UserData;
         if(!pInfo)return -1;
+        pInfo->m_index.uncacheable ();
+        char buf[PASSWD_MAX];
         if(!(pInfo->m_mode & M_ERROR_MESSAGE_OFF)){
-          pwd=askpass_dialog (0);
+          pwd=askpass_dialog (0, buf);
         }
         if(pwd){
           strncpy((char*)P1,pwd,P2);
@@ -590,7 +1535,7 @@ init_exinfo (EXTRACTINGINFOEX &ex, const rarHeaderData &hd,
   ex.wRatio = calc_ratio (hd.PackSizeHigh, hd.PackSize, hd.UnpSizeHigh, hd.UnpSize);
   ex.wDate = HIWORD (hd.FileTime);
   ex.wTime = LOWORD (hd.FileTime);
-  strcpy (ex.szAttribute, attr_string (hd.FileAttr));
+  attr_string (hd.FileAttr, ex.szAttribute);
   strcpy (ex.szMode, method_string (hd.Method));
 }
 
@@ -611,19 +1556,32 @@ UnRAR::skip (rarData &rd, const char *path) const
 
 int
 UnRAR::extract (rarData &rd, const char *path, const rarHeaderData &hd,
-                progress_dlg &progress)
+                extract_thread &t)
 {
+  progress_dlg &progress = *t.progress;
   if (progress.m_hwnd)
     progress.init (path, hd.UnpSize, hd.UnpSizeHigh);
 
-  int e = check_timestamp (path, hd);
+  /* Replace prompts are asked one at a time, but without m_lock, so
+     that the other workers go on reporting while one is open. */
+  int e;
+  {
+    cs_lock lock (m_prompt_lock);
+    e = check_timestamp (path, hd);
+  }
   if (e < 0)
     return canceled ();
   if (!e)
     return skip (rd, path);
 
   write_handle w (path);
-  if (!w.open ())
+  if (!w.open () && t.fin)
+    {
+      /* The same name may still be open in the finisher. */
+      t.fin->drain ();
+      w.open ();
+    }
+  if (!w.is_valid ())
     {
       format (IDS_CANNOT_CREATE, path);
       return skip (rd, path);
@@ -643,19 +1601,28 @@ UnRAR::extract (rarData &rd, const char *path, const rarHeaderData &hd,
   xinfo.canceled = false;
   xinfo.error = false;
   xinfo.nbytes.d = 0;
-  xinfo.xex = &m_ex;
-  xtract_info = &xinfo;
+  xinfo.xex = t.xex;
+  xinfo.cancel = &m_cancel;
+  xinfo.done = &t.done;
+  xinfo.wb = t.wb && t.wb->is_open () ? t.wb : 0;
+  xinfo.notify = m_owner.has_callback ? m_notify : 0;
+  xinfo.mem = 0;
+  xinfo.ostr = 0;
+  xinfo.discard = false;
   format (IDS_EXTRACTING, path);
 
-  if (lstate.has_callback)
+  if (xinfo.notify)
     {
       init_exinfo (*xinfo.xex, hd, path);
-      if (run_callback (ARCEXTRACT_BEGIN, *xinfo.xex))
+      if (xinfo.notify->send (ARCEXTRACT_BEGIN, *xinfo.xex))
         return canceled ();
     }
 
+  rd.pExtractInfo = &xinfo;
   e = rd.test ();
-  xtract_info = 0;
+  rd.pExtractInfo = 0;
+  if (xinfo.wb && !xinfo.wb->flush ())
+    xinfo.error = true;
   if (xinfo.canceled)
     return canceled ();
   if (e)
@@ -665,66 +1632,220 @@ UnRAR::extract (rarData &rd, const char *path, const rarHeaderData &hd,
       format (IDS_WRITE_ERROR, path);
       return -1;
     }
-  if (!SetEndOfFile (w))
-    {
-      format (IDS_CANNOT_SET_EOF);
-      return -1;
-    }
 
   w.complete ();
-
-  FILETIME lo, ft;
-  DosDateTimeToFileTime (hd.FileTime >> 16, hd.FileTime, &lo);
-  LocalFileTimeToFileTime (&lo, &ft);
-  SetFileTime (w, 0, 0, &ft);
-  SetFileAttributes (path, hd.FileAttr);
-
+  t.fin->finish (w.detach (), path, hd, w.delete_if_fail ());
+  m_snap.update (path, hd);
   return 0;
 }
 
 const char* UnRAR::get_password()
 {
   if (m_passwd) return m_passwd;
+  else if (m_nthreads > 1){
+      /* Ask only once, not once per worker. */
+      cs_lock lock (m_lock);
+      if (!m_passwd)
+        m_passwd = askpass_dialog (m_hwnd, m_passwd_buf);
+      return m_passwd;
+    }
   else{
-      return askpass_dialog (m_hwnd);
+      return askpass_dialog (m_hwnd, m_passwd_buf);
     }
 }
 
+bool
+UnRAR::known_dir (const char *path, size_t l)
+{
+  cs_lock lock (m_dirs_lock);
+  return m_dirs.find (path, l) != 0;
+}
+
+void
+UnRAR::add_dir (const char *path, size_t l)
+{
+  cs_lock lock (m_dirs_lock);
+  m_dirs.insert (path, l);
+}
+
+static bool
+is_dir (const char *path)
+{
+  DWORD a = GetFileAttributes (path);
+  return a != -1 && a & FILE_ATTRIBUTE_DIRECTORY;
+}
+
+/* Directories known to exist are remembered for the rest of the
+   extraction, so that extracting many files into the same tree costs
+   no system calls once the tree is there. */
 int
 UnRAR::mkdirhier (const char *path)
 {
+  size_t l = strlen (path);
+  if (known_dir (path, l))
+    return 1;
   if (CreateDirectory (path, 0))
     {
       format (IDS_CREATING, path);
+      add_dir (path, l);
+      m_snap.created_dir (path, l);
+      return 1;
+    }
+  if (GetLastError () != ERROR_PATH_NOT_FOUND && is_dir (path))
+    {
+      add_dir (path, l);
       return 1;
     }
-  DWORD a = GetFileAttributes (path);
-  if (a != -1 && a & FILE_ATTRIBUTE_DIRECTORY)
-    return 1;
   char buf[FNAME_MAX32 + FRAR_PATH_MAX + 1];
   strcpy (buf, path);
   for (char *p = buf; p = find_slash (p); *p++ = '\\')
     {
       *p = 0;
+      if (p == buf || known_dir (buf, p - buf))
+        continue;
       if (CreateDirectory (buf, 0))
-        format (IDS_CREATING, buf);
+        {
+          format (IDS_CREATING, buf);
+          m_snap.created_dir (buf, p - buf);
+        }
+      else if (!is_dir (buf))
+        continue;
+      add_dir (buf, p - buf);
     }
   if (CreateDirectory (path, 0))
     {
       format (IDS_CREATING, path);
+      add_dir (path, l);
+      m_snap.created_dir (path, l);
+      return 1;
+    }
+  if (is_dir (path))
+    {
+      add_dir (path, l);
       return 1;
     }
-  a = GetFileAttributes (path);
-  if (a != -1 && a & FILE_ATTRIBUTE_DIRECTORY)
-    return 1;
   format (IDS_CANNOT_CREATE, path);
   return 0;
 }
 
+/* Decompresses the current entry without writing it anywhere, so that
+   UnRAR.DLL checks its CRC. */
+int
+UnRAR::test_file (rarData &rd, extract_thread &t)
+{
+  const rarHeaderData &hd = rd.hd;
+  progress_dlg &progress = *t.progress;
+  if (progress.m_hwnd)
+    progress.init (hd.FileName, hd.UnpSize, hd.UnpSizeHigh);
+
+  extract_info xinfo;
+  memset (&xinfo, 0, sizeof xinfo);
+  xinfo.progress = progress.m_hwnd ? &progress : 0;
+  xinfo.hwnd_owner = m_hwnd;
+  xinfo.hd = &hd;
+  xinfo.path = hd.FileName;
+  xinfo.xex = t.xex;
+  xinfo.cancel = &m_cancel;
+  xinfo.done = &t.done;
+  xinfo.notify = m_owner.has_callback ? m_notify : 0;
+  xinfo.discard = true;
+
+  if (xinfo.notify)
+    {
+      init_exinfo (*xinfo.xex, hd, hd.FileName);
+      if (xinfo.notify->send (ARCEXTRACT_BEGIN, *xinfo.xex))
+        return canceled ();
+    }
+
+  rd.pExtractInfo = &xinfo;
+  int e = rd.test ();
+  rd.pExtractInfo = 0;
+  if (xinfo.canceled)
+    return canceled ();
+  if (e)
+    {
+      e = process_err (e, hd.FileName,rd);
+      return e == ERROR_FILE_CRC ? -1 : e;
+    }
+
+  format (IDS_TEST_OK, hd.FileName);
+  cs_lock lock (m_lock);
+  m_ntested++;
+  m_tested_bytes.d += xinfo.nbytes.d;
+  return 0;
+}
+
+/* Returns 0 on success, -1 if the entry failed but extraction can go
+   on, or an error code that aborts the whole archive. */
+int
+UnRAR::extract_entry (rarData &rd, char *dest, char *de, extract_thread &t)
+{
+  int e;
+  if (!m_glob.match (rd.hd.FileName, (m_opt & O_STRICT) != 0, (m_opt & O_RECURSIVE) != 0))
+    {
+      e = rd.skip ();
+      return e ? process_err (e, rd.hd.FileName,rd) : 0;
+    }
+
+  if (m_cmd == C_TEST)
+    {
+      if ((rd.hd.Flags & 0xE0) == 0xE0)
+        {
+          e = rd.skip ();
+          return e ? process_err (e, rd.hd.FileName,rd) : 0;
+        }
+      return test_file (rd, t);
+    }
+
+  const char *name = trim_root (rd.hd.FileName);
+  if (m_cmd == C_EXTRACT)
+    {
+      strcpy (de, name);
+      if (m_security_level >= 2)
+        sanitize_path (de);
+    }
+  else
+    {
+      char *sl = find_last_slash (name);
+      strcpy (de, sl ? sl + 1 : name);
+    }
+  if (!*de)
+    {
+      e = rd.skip ();
+      return e ? process_err (e, dest,rd) : 0;
+    }
+  //else if (rd.hd.FileAttr & FILE_ATTRIBUTE_DIRECTORY)
+  if ((rd.hd.Flags & 0xE0) == 0xE0)  //Directory check modified:Not with rd.hd.FileAttr,but with rd.hd.Flags
+    {
+      if (m_cmd == C_EXTRACT && !mkdirhier (dest))
+        return ERROR_DIRECTORY;
+      e = rd.skip ();
+      return e ? process_err (e, dest,rd) : 0;
+    }
+
+  char *p = find_last_slash (dest);
+  if (p)
+    {
+      *p = 0;
+      if (!mkdirhier (dest))
+        return ERROR_DIRECTORY;
+      *p = '\\';
+    }
+  return extract (rd, dest, rd.hd, t);
+}
+
 int
 UnRAR::extract1 ()
 {
-  format (IDS_EXTRACTING_FROM, m_path);
+  if (m_nthreads > 1)
+    {
+      int e = extract_mt ();
+      if (e >= 0)
+        return e;
+      m_nthreads = 1;
+    }
+
+  format (m_cmd == C_TEST ? IDS_TESTING_FROM : IDS_EXTRACTING_FROM, m_path);
 
   rarData rd;
   if (!rd.open (m_path, RAR_OM_EXTRACT))
@@ -737,9 +1858,25 @@ UnRAR::extract1 ()
   rarSetCallback(rd.h,rar_event_handler,(LPARAM)&rd);
 
   progress_dlg progress;
-  if (!lstate.has_callback && !(m_opt & O_QUIET))
+  if (!m_owner.has_callback && !(m_opt & O_QUIET))
     progress.create (m_hwnd);
 
+  write_behind wb;
+  if (m_wb_nbufs && m_cmd != C_TEST)
+    wb.open (m_wb_nbufs, m_wb_bufsize);
+
+  file_finisher fin (*this);
+  if (m_cmd != C_TEST)
+    fin.open ();
+
+  extract_thread t;
+  t.progress = &progress;
+  t.wb = &wb;
+  t.fin = &fin;
+  t.xex = &m_ex;
+  t.done = 0;
+  m_cancel = 0;
+
   char dest[FNAME_MAX32 + FRAR_PATH_MAX + 1];
   char *de = stpcpy (dest, m_dest);
   slash2backsl (dest);
@@ -752,80 +1889,259 @@ UnRAR::extract1 ()
       if (e)
         {
           e = header_err (e,rd);
-          return e ? e : nerrors;
+          fin.close ();
+          return e ? e : nerrors + fin.nerrors ();
         }
 
-      if (!m_glob.match (rd.hd.FileName, (m_opt & O_STRICT) != 0, (m_opt & O_RECURSIVE) != 0))
+      e = extract_entry (rd, dest, de, t);
+      if (e > 0)
+        return e;
+      if (e < 0)
+        nerrors++;
+    }
+}
+
+/* Walks the headers once to see whether the entries can be handed out
+   to independent workers.  Solid archives cannot, since every file
+   depends on the ones before it, and neither can volume sets, since
+   every worker would prompt for the next volume on its own.  Both are
+   told by the main header when it can be read, without the walk. */
+bool
+UnRAR::scan_entries (int64 &total)
+{
+  rar_headers rh;
+  if (!rh.open (m_path)
+      && rh.flags () & (UNRAR_ARC_VOLUME | UNRAR_ARC_SOLID))
+    return false;
+
+  rarData rd;
+  if (!rd.open (m_path, RAR_OM_LIST))
+    return false;
+
+  rd.pUserData=this;
+  if(m_opt & O_NOT_ASK_PASSWORD){
+    rd.can_ask_password=false;
+  }
+  rarSetCallback(rd.h,rar_event_handler,(LPARAM)&rd);
+
+  total.d = 0;
+  int n, e;
+  for (n = 0; !(e = rd.read_header ()); n++)
+    {
+      if (rd.hd.Flags & (FRAR_SOLID | FRAR_PREVVOL | FRAR_NEXTVOL))
+        return false;
+      if (m_glob.match (rd.hd.FileName, (m_opt & O_STRICT) != 0, (m_opt & O_RECURSIVE) != 0))
         {
-          e = rd.skip ();
-          if (e)
-            return process_err (e, rd.hd.FileName,rd);
+          int64 u;
+          u.s.l = rd.hd.UnpSize;
+          u.s.h = rd.hd.UnpSizeHigh;
+          total.d += u.d;
+        }
+      if (rd.skip ())
+        return false;
+    }
+  if (e != ERAR_END_ARCHIVE)
+    return false;
+
+  /* One extra slot stands for everything past the last entry seen
+     here, so that trailing errors are reported by a single worker. */
+  m_nentries = n;
+  m_claim = (volatile LONG *)calloc (n + 1, sizeof *m_claim);
+  return m_claim != 0;
+}
+
+unsigned __stdcall
+UnRAR::extract_thread_proc (void *arg)
+{
+  extract_thread *t = (extract_thread *)arg;
+  t->unrar->extract_worker (*t);
+  return 0;
+}
+
+void
+UnRAR::extract_worker (extract_thread &t)
+{
+  rarData rd;
+  if (!rd.open (m_path, RAR_OM_EXTRACT))
+    {
+      if (!InterlockedExchange (&m_abort, 1))
+        {
+          t.err = open_err (rd.oad.OpenResult);
+          t.err_index = 0;
+        }
+      return;
+    }
+
+  rd.pUserData=this;
+  if(m_opt & O_NOT_ASK_PASSWORD){
+    rd.can_ask_password=false;
+  }
+  rarSetCallback(rd.h,rar_event_handler,(LPARAM)&rd);
+
+  write_behind wb;
+  if (m_wb_nbufs && m_cmd != C_TEST)
+    wb.open (m_wb_nbufs, m_wb_bufsize);
+  t.wb = &wb;
+
+  file_finisher fin (*this);
+  if (m_cmd != C_TEST)
+    fin.open ();
+  t.fin = &fin;
+
+  char dest[FNAME_MAX32 + FRAR_PATH_MAX + 1];
+  char *de = stpcpy (dest, m_dest);
+  slash2backsl (dest);
+
+  bool tail = false;
+  for (int i = 0; !m_abort && !m_cancel; i++)
+    {
+      bool mine;
+      if (i <= m_nentries)
+        {
+          mine = !m_claim[i] && !InterlockedExchange (&m_claim[i], 1);
+          tail = mine;
         }
       else
+        mine = tail;
+
+      int e = rd.read_header ();
+      if (e)
         {
-          const char *name = trim_root (rd.hd.FileName);
-          if (m_cmd == C_EXTRACT)
-            {
-              strcpy (de, name);
-              if (m_security_level >= 2)
-                sanitize_path (de);
-            }
-          else
+          if (mine)
             {
-              char *sl = find_last_slash (name);
-              strcpy (de, sl ? sl + 1 : name);
-            }
-          if (!*de)
-            {
-              e = rd.skip ();
-              if (e)
-                return process_err (e, dest,rd);
-            }
-          //else if (rd.hd.FileAttr & FILE_ATTRIBUTE_DIRECTORY)
-          else if ((rd.hd.Flags & 0xE0) == 0xE0)  //Directory check modified:Not with rd.hd.FileAttr,but with rd.hd.Flags
-            {
-              if (m_cmd == C_EXTRACT && !mkdirhier (dest))
-                return ERROR_DIRECTORY;
-              e = rd.skip ();
-              if (e)
-                return process_err (e, dest,rd);
-            }
-          else
-            {
-              char *p = find_last_slash (dest);
-              if (p)
-                {
-                  *p = 0;
-                  if (!mkdirhier (dest))
-                    return ERROR_DIRECTORY;
-                  *p = '\\';
-                }
-              e = extract (rd, dest, rd.hd, progress);
-              if (e)
-                {
-                  if (e > 0)
-                    return e;
-                  nerrors++;
-                }
+              t.err = header_err (e,rd);
+              t.err_index = i;
+              if (t.err)
+                InterlockedExchange (&m_abort, 1);
             }
+          break;
         }
+
+      if (!mine)
+        {
+          e = rd.skip ();
+          e = e ? process_err (e, rd.hd.FileName,rd) : 0;
+        }
+      else
+        e = extract_entry (rd, dest, de, t);
+      if (e > 0)
+        {
+          t.err = e;
+          t.err_index = i;
+          InterlockedExchange (&m_abort, 1);
+          break;
+        }
+      if (e < 0)
+        t.nerrors++;
     }
+
+  fin.close ();
+  t.nerrors += fin.nerrors ();
+}
+
+/* Extracts a non-solid archive with m_nthreads workers, each reading
+   the archive through its own handle.  Every worker walks all the
+   headers and claims entries first come, first served, so a worker
+   stuck on a large file is simply overtaken by the others.  Returns -1
+   if the archive has to be extracted sequentially. */
+int
+UnRAR::extract_mt ()
+{
+  int64 total;
+  if (!scan_entries (total))
+    return -1;
+
+  format (m_cmd == C_TEST ? IDS_TESTING_FROM : IDS_EXTRACTING_FROM, m_path);
+
+  m_abort = 0;
+  m_cancel = 0;
+
+  progress_dlg nodlg;
+  extract_thread threads[MAX_EXTRACT_THREADS];
+  HANDLE handles[MAX_EXTRACT_THREADS];
+  int nthreads = 0;
+  for (int i = 0; i < m_nthreads; i++)
+    {
+      extract_thread &t = threads[nthreads];
+      t.unrar = this;
+      t.progress = &nodlg;
+      t.xex = &t.ex;
+      t.ex = m_ex;
+      t.done = 0;
+      t.nerrors = 0;
+      t.err = 0;
+      t.err_index = INT_MAX;
+      t.h = HANDLE (_beginthreadex (0, 0, extract_thread_proc, &t, 0, 0));
+      if (!t.h)
+        break;
+      handles[nthreads++] = t.h;
+    }
+  if (!nthreads)
+    return -1;
+
+  progress_dlg progress;
+  if (!m_owner.has_callback && !(m_opt & O_QUIET)
+      && progress.create (m_hwnd))
+    progress.init (m_path, total.s.l, total.s.h);
+
+  /* Keep pumping messages: the workers' dialogs and SendMessage calls
+     are owned by windows of this thread. */
+  for (int nrunning = nthreads; nrunning;)
+    {
+      DWORD r = MsgWaitForMultipleObjects (nrunning, handles, 0,
+                                           progress.m_hwnd ? 200 : INFINITE,
+                                           QS_ALLINPUT);
+      if (r < WAIT_OBJECT_0 + nrunning)
+        handles[r - WAIT_OBJECT_0] = handles[--nrunning];
+      else if (progress.m_hwnd)
+        {
+          int64 done;
+          done.d = 0;
+          for (int i = 0; i < nthreads; i++)
+            done.d += threads[i].done;
+          if (!progress.update (done))
+            InterlockedExchange (&m_cancel, 1);
+        }
+      else
+        doevents ();
+    }
+
+  int nerrors = 0, e = 0, index = INT_MAX;
+  for (int i = 0; i < nthreads; i++)
+    {
+      CloseHandle (threads[i].h);
+      nerrors += threads[i].nerrors;
+      if (threads[i].err && threads[i].err_index < index)
+        {
+          e = threads[i].err;
+          index = threads[i].err_index;
+        }
+    }
+  if (!e && m_cancel)
+    return canceled ();
+  return e ? e : nerrors;
 }
 
 int
 UnRAR::extract ()
 {
-  if (lstate.has_callback)
+  event_notifier notify;
+  if (m_owner.has_callback)
     {
+      notify.open (m_owner, m_cb_interval, m_cb_delta);
       memset (&m_ex, 0, sizeof m_ex);
       strlcpy (m_ex.exinfo.szSourceFileName, m_path, sizeof m_ex.exinfo.szSourceFileName);
-      if (run_callback (ARCEXTRACT_OPEN, m_ex))
+      if (notify.send (ARCEXTRACT_OPEN, m_ex))
         return canceled ();
     }
 
+  m_notify = &notify;
   int e = extract1 ();
-  if (lstate.has_callback)
-    run_callback (ARCEXTRACT_END, m_ex);
+  m_notify = 0;
+  m_dirs.clear ();
+  m_snap.clear ();
+  if (m_owner.has_callback)
+    notify.send (ARCEXTRACT_END, m_ex);
 
   return e;
 }
@@ -833,22 +2149,83 @@ UnRAR::extract ()
 int
 UnRAR::test ()
 {
-  format (IDS_TEST_NOT_IMPL);
-  return ERROR_NOT_SUPPORT;
+  m_ntested = 0;
+  m_tested_bytes.d = 0;
+  DWORD start = GetTickCount ();
+  int e = extract ();
+  DWORD msec = max (GetTickCount () - start, DWORD (1));
+  /* A positive result below ERROR_START is the number of files that
+     failed; anything else stopped the test short. */
+  if (!e)
+    format (IDS_TEST_SUMMARY, m_ntested, m_tested_bytes.d,
+            msec / 1000, msec % 1000,
+            DWORD (m_tested_bytes.d * 1000 / 1024 / msec));
+  else if (e > 0 && e < ERROR_START)
+    format (IDS_TEST_ERRORS, m_ntested + e, e);
+  else
+    format (IDS_TEST_ABORTED, m_ntested);
+  return e;
+}
+
+void
+UnRAR::list_file (const rarHeaderData &hd, int64 &org_sz, int64 &comp_sz) const
+{
+  if (m_cmd == C_VLIST)
+    format ("%s\n%15c", hd.FileName, ' ');
+  else
+    {
+      char *p = find_last_slash (hd.FileName);
+      format ("%-14s ", p ? p + 1 : hd.FileName);
+    }
+  int ratio = calc_ratio (hd.PackSizeHigh, hd.PackSize,
+                          hd.UnpSizeHigh, hd.UnpSize);
+  int64 u, p;
+  u.s.l = hd.UnpSize;
+  u.s.h = hd.UnpSizeHigh;
+  p.s.l = hd.PackSize;
+  p.s.h = hd.PackSizeHigh;
+  org_sz.d += u.d;
+  comp_sz.d += p.d;
+  char attr[5];
+  format ("%8I64d %8I64d%c%3d.%d%%%c%02d-%02d-%02d %02d:%02d:%02d %s %-7s %08x\n",
+          u, p,
+          hd.Flags & FRAR_PREVVOL ? '<' : ' ',
+          ratio / 10, ratio % 10,
+          hd.Flags & FRAR_NEXTVOL ? '>' : ' ',
+          ((hd.FileTime >> 25) + 80) % 100,
+          (hd.FileTime >> 21) & 15,
+          (hd.FileTime >> 16) & 31,
+          (hd.FileTime >> 11) & 31,
+          (hd.FileTime >> 5) & 63,
+          (hd.FileTime & 31) * 2,
+          attr_string (hd.FileAttr, attr),
+          method_string (hd.Method),
+          hd.FileCRC);
 }
 
+/* Lists the matching files.  The headers come from the index cache
+   when the archive has not changed since it was last listed in full,
+   or are read from the archive without UnRAR.DLL when they are in the
+   clear, and are saved in the cache otherwise. */
 int
 UnRAR::list ()
 {
+  header_index index;
   rarData rd;
-  if (!rd.open (m_path, RAR_OM_LIST))
-    return open_err (rd.oad.OpenResult);
+  bool cached = ((header_index::enabled () && index.load (m_path))
+                 || index.build (m_path));
+  bool recording = !cached && header_index::enabled ();
+  if (!cached)
+    {
+      if (!rd.open (m_path, RAR_OM_LIST))
+        return open_err (rd.oad.OpenResult);
 
-  rd.pUserData=this;
-  if(m_opt & O_NOT_ASK_PASSWORD){
-    rd.can_ask_password=false;
-  }
-  rarSetCallback(rd.h,rar_event_handler,(LPARAM)&rd);
+      rd.pUserData=this;
+      if(m_opt & O_NOT_ASK_PASSWORD){
+        rd.can_ask_password=false;
+      }
+      rarSetCallback(rd.h,rar_event_handler,(LPARAM)&rd);
+    }
 
   format ("  Name         Original   Packed  Ratio   Date     Time   Attr Method  CRC\n");
   format ("-------------- -------- -------- ------ -------- -------- ---- ------- --------\n");
@@ -857,52 +2234,39 @@ UnRAR::list ()
   int e;
 
   org_sz.d = comp_sz.d = 0;
-  for (;;)
+  for (int i = 0;; i++)
     {
-      e = rd.read_header ();
-      if (e)
+      if (cached)
         {
-          if (e == ERAR_END_ARCHIVE)
+          if (i == index.count ())
             break;
-          return header_err (e,rd);
+          index.get (i, rd.hd);
         }
-      if (m_glob.match (rd.hd.FileName, (m_opt & O_STRICT) != 0, (m_opt & O_RECURSIVE) != 0))
+      else
         {
-          nfiles++;
-          if (m_cmd == C_VLIST)
-            format ("%s\n%15c", rd.hd.FileName, ' ');
-          else
+          e = rd.read_header ();
+          if (e)
             {
-              char *p = find_last_slash (rd.hd.FileName);
-              format ("%-14s ", p ? p + 1 : rd.hd.FileName);
+              if (e != ERAR_END_ARCHIVE)
+                return header_err (e,rd);
+              if (recording && !rd.asked_password)
+                index.save (m_path);
+              break;
             }
-          int ratio = calc_ratio (rd.hd.PackSizeHigh, rd.hd.PackSize,
-                                  rd.hd.UnpSizeHigh, rd.hd.UnpSize);
-          int64 u, p;
-          u.s.l = rd.hd.UnpSize;
-          u.s.h = rd.hd.UnpSizeHigh;
-          p.s.l = rd.hd.PackSize;
-          p.s.h = rd.hd.PackSizeHigh;
-          org_sz.d += u.d;
-          comp_sz.d += p.d;
-          format ("%8I64d %8I64d%c%3d.%d%%%c%02d-%02d-%02d %02d:%02d:%02d %s %-7s %08x\n",
-                  u, p,
-                  rd.hd.Flags & FRAR_PREVVOL ? '<' : ' ',
-                  ratio / 10, ratio % 10,
-                  rd.hd.Flags & FRAR_NEXTVOL ? '>' : ' ',
-                  ((rd.hd.FileTime >> 25) + 80) % 100,
-                  (rd.hd.FileTime >> 21) & 15,
-                  (rd.hd.FileTime >> 16) & 31,
-                  (rd.hd.FileTime >> 11) & 31,
-                  (rd.hd.FileTime >> 5) & 63,
-                  (rd.hd.FileTime & 31) * 2,
-                  attr_string (rd.hd.FileAttr),
-                  method_string (rd.hd.Method),
-                  rd.hd.FileCRC);
+          if (recording)
+            recording = index.add (rd.hd);
+        }
+      if (m_glob.match (rd.hd.FileName, (m_opt & O_STRICT) != 0, (m_opt & O_RECURSIVE) != 0))
+        {
+          nfiles++;
+          list_file (rd.hd, org_sz, comp_sz);
+        }
+      if (!cached)
+        {
+          e = rd.skip ();
+          if (e)
+            return process_err (e, rd.hd.FileName,rd);
         }
-      e = rd.skip ();
-      if (e)
-        return process_err (e, rd.hd.FileName,rd);
     }
 
   if (nfiles)
@@ -917,11 +2281,55 @@ UnRAR::list ()
   return 0;
 }
 
+/* Writes the contents of the matching files to the output buffer, a
+   chunk at a time as they are decompressed. */
 int
 UnRAR::print ()
 {
-  format (IDS_PRINT_NOT_IMPL);
-  return ERROR_NOT_SUPPORT;
+  rarData rd;
+  if (!rd.open (m_path, RAR_OM_EXTRACT))
+    return open_err (rd.oad.OpenResult);
+
+  rd.pUserData=this;
+  if(m_opt & O_NOT_ASK_PASSWORD){
+    rd.can_ask_password=false;
+  }
+  rarSetCallback(rd.h,rar_event_handler,(LPARAM)&rd);
+  m_cancel = 0;
+
+  for (;;)
+    {
+      int e = rd.read_header ();
+      if (e)
+        return header_err (e,rd);
+      if ((rd.hd.Flags & 0xE0) == 0xE0
+          || !m_glob.match (rd.hd.FileName, (m_opt & O_STRICT) != 0,
+                            (m_opt & O_RECURSIVE) != 0))
+        {
+          e = rd.skip ();
+          if (e)
+            return process_err (e, rd.hd.FileName,rd);
+          continue;
+        }
+
+      extract_info xinfo;
+      memset (&xinfo, 0, sizeof xinfo);
+      xinfo.hwnd_owner = m_hwnd;
+      xinfo.hd = &rd.hd;
+      xinfo.path = rd.hd.FileName;
+      xinfo.cancel = &m_cancel;
+      xinfo.ostr = &m_ostr;
+
+      rd.pExtractInfo = &xinfo;
+      e = rd.test ();
+      rd.pExtractInfo = 0;
+      if (xinfo.canceled)
+        return canceled ();
+      if (xinfo.full)
+        return m_ostr.has_sink () ? ERROR_USER_CANCEL : ERROR_BUF_TOO_SMALL;
+      if (e)
+        return process_err (e, rd.hd.FileName,rd);
+    }
 }
 
 int
@@ -931,6 +2339,86 @@ UnRAR::comment ()
   return ERROR_NOT_SUPPORT;
 }
 
+/* Extracts the first file that matches the file specs into BUF. */
+int
+UnRAR::extract_mem (int ac, char **av, u_char *buf, DWORD size,
+                    time_t *time, WORD *attr, DWORD *nwritten)
+{
+  if (nwritten)
+    *nwritten = 0;
+
+  int e = parse_opt (ac, av);
+  if (e)
+    return e;
+
+  rarData rd;
+  if (!rd.open (m_path, RAR_OM_EXTRACT))
+    return open_err (rd.oad.OpenResult);
+
+  rd.pUserData=this;
+  if(m_opt & O_NOT_ASK_PASSWORD){
+    rd.can_ask_password=false;
+  }
+  rarSetCallback(rd.h,rar_event_handler,(LPARAM)&rd);
+
+  for (;;)
+    {
+      e = rd.read_header ();
+      if (e)
+        {
+          e = header_err (e,rd);
+          return e ? e : ERROR_NOT_EXIST;
+        }
+      if ((rd.hd.Flags & 0xE0) == 0xE0
+          || !m_glob.match (rd.hd.FileName, (m_opt & O_STRICT) != 0,
+                            (m_opt & O_RECURSIVE) != 0))
+        {
+          e = rd.skip ();
+          if (e)
+            return process_err (e, rd.hd.FileName,rd);
+          continue;
+        }
+
+      extract_info xinfo;
+      memset (&xinfo, 0, sizeof xinfo);
+      xinfo.hwnd_owner = m_hwnd;
+      xinfo.hd = &rd.hd;
+      xinfo.path = rd.hd.FileName;
+      xinfo.cancel = &m_cancel;
+      xinfo.mem = buf;
+      xinfo.mem_size = size;
+      m_cancel = 0;
+
+      rd.pExtractInfo = &xinfo;
+      e = rd.test ();
+      rd.pExtractInfo = 0;
+      if (xinfo.canceled)
+        return canceled ();
+      if (e && !xinfo.full)
+        return process_err (e, rd.hd.FileName,rd);
+
+      if (nwritten)
+        *nwritten = xinfo.nbytes.s.l;
+      if (attr)
+        *attr = WORD (rd.hd.FileAttr);
+      if (time)
+        {
+          FILETIME lo, ft;
+          DosDateTimeToFileTime (rd.hd.FileTime >> 16, rd.hd.FileTime, &lo);
+          LocalFileTimeToFileTime (&lo, &ft);
+          int64 t;
+          t.s.l = ft.dwLowDateTime;
+          t.s.h = ft.dwHighDateTime;
+          /* 0x019db1ded53e8000 is 1970-01-01 as a FILETIME. */
+          *time = time_t ((t.d - ((__int64)0x019db1de << 32 | 0xd53e8000))
+                          / 10000000);
+        }
+      /* A file cut short at the end of the buffer is told apart from
+         one that fills it exactly. */
+      return xinfo.full ? ERROR_BUF_TOO_SMALL : 0;
+    }
+}
+
 int
 UnRAR::xmain (int ac, char **av)
 {
@@ -16,6 +16,35 @@
 #ifndef _rar_h_
 # define _rar_h_
 
+/* Contents of the destination directories, read once per directory
+   the first time a file in it is about to be overwritten, and kept up
+   to date as files are extracted. */
+class dest_snapshot
+{
+public:
+  struct file_info
+    {
+      DWORD time;
+      int64 size;
+    };
+
+  dest_snapshot ()
+       : m_dirs (sizeof (int)), m_files (sizeof (file_info))
+    {}
+  int lookup (const char *path, file_info &fi);
+  void created_dir (const char *path, size_t l);
+  void update (const char *path, const rarHeaderData &hd);
+  void clear ();
+
+private:
+  enum {DIR_SCANNED = 1, DIR_UNKNOWN};
+  critical_section m_lock;
+  path_set m_dirs;
+  path_set m_files;
+
+  int scan (const char *dir, size_t l);
+};
+
 class UnRAR
 {
 public:
@@ -43,11 +72,26 @@ public:
 	  O_NOT_ASK_PASSWORD = 32,
     };
 
+  enum
+    {
+      MAX_EXTRACT_THREADS = MAXIMUM_WAIT_OBJECTS - 1,
+      WRITE_BEHIND_NBUFS = 4,
+      WRITE_BEHIND_BUFSIZE = 1024 * 1024,
+      WRITE_BEHIND_MAX_NBUFS = 256,
+      WRITE_BEHIND_MAX_BUFSIZE = 64 * 1024 * 1024,
+      WRITE_BEHIND_MAX_TOTAL = 256 * 1024 * 1024,
+      CALLBACK_INTERVAL = 50
+    };
+
 public:
   int xmain (int argc, char **argv);
+  int extract_mem (int argc, char **argv, u_char *buf, DWORD size,
+                   time_t *time, WORD *attr, DWORD *nwritten);
   UnRAR (HWND hwnd, ostrbuf &ostr)
-       : m_hwnd (hwnd), m_ostr (ostr)
-    {}
+       : m_hwnd (hwnd), m_ostr (ostr), m_claim (0), m_notify (0)
+    {current_owner (m_owner);}
+  ~UnRAR ()
+    {if (m_claim) free ((void *)m_claim);}
 
   const char* get_password();
   int CheckArchive(const char *path, int mode);
@@ -60,21 +104,51 @@ private:
   const char *m_path;
   const char *m_dest;
   const char *m_passwd;
+  int m_nthreads;
+  int m_wb_nbufs;
+  DWORD m_wb_bufsize;
+  DWORD m_cb_interval;
+  DWORD m_cb_delta;
 
   HWND m_hwnd;
+  owner_info m_owner;
+  char m_passwd_buf[PASSWD_MAX];
 
   ostrbuf &m_ostr;
   glob m_glob;
   EXTRACTINGINFOEX m_ex;
 
+  mutable critical_section m_lock;
+  volatile LONG *m_claim;
+  int m_nentries;
+  volatile LONG m_abort;
+  volatile LONG m_cancel;
+
+  critical_section m_dirs_lock;
+  critical_section m_prompt_lock;
+  path_set m_dirs;
+  dest_snapshot m_snap;
+  class event_notifier *m_notify;
+  int m_ntested;
+  int64 m_tested_bytes;
+
   int mkdirhier (const char *path);
+  bool known_dir (const char *path, size_t l);
+  void add_dir (const char *path, size_t l);
   int check_timestamp (const char *path, const rarHeaderData &hd);
   int parse_opt (int ac, char **av);
   int extract (rarData &rd, const char *path, const rarHeaderData &hd,
-               class progress_dlg &process);
+               struct extract_thread &t);
+  int extract_entry (rarData &rd, char *dest, char *de, extract_thread &t);
+  int test_file (rarData &rd, extract_thread &t);
   int extract ();
   int extract1 ();
+  int extract_mt ();
+  bool scan_entries (int64 &total);
+  void extract_worker (extract_thread &t);
+  static unsigned __stdcall extract_thread_proc (void *);
   int print ();
+  void list_file (const rarHeaderData &hd, int64 &org_sz, int64 &comp_sz) const;
   int list ();
   int test ();
   int comment ();
@@ -87,6 +161,8 @@ private:
   int process_err (int e,const char *path, const rarData &rd) const;
   int canceled () const;
   int skip (rarData &rd, const char *path) const;
+
+  friend class file_finisher;
 };
 
 //Callback for UnRAR.DLL
@@ -0,0 +1,737 @@
+/*
+ *   Copyright (c) 1998-2004 T. Kamei (kamei@jsdlab.co.jp)
+ *
+ *   Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose is hereby granted provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies of the software and related documentation.
+ *
+ *                          NO WARRANTY
+ *
+ *   THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY WARRANTIES;
+ * WITHOUT EVEN THE IMPLIED WARRANTIES OF MERCHANTABILITY OR FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ */
+
+#include "comm-arc.h"
+#include "unrarapi.h"
+#include "util.h"
+#include "mapf.h"
+#include "rarhdr.h"
+#include "unrar32.h"
+
+/* RAR 1.5-4.x block types, and main and file header flags. */
+#define HEAD3_MAIN 0x73
+#define HEAD3_FILE 0x74
+#define HEAD3_SERVICE 0x7a
+#define HEAD3_ENDARC 0x7b
+#define MHD_VOLUME 0x0001
+#define MHD_COMMENT 0x0002
+#define MHD_LOCK 0x0004
+#define MHD_SOLID 0x0008
+#define MHD_NEWNUMBERING 0x0010
+#define MHD_PROTECT 0x0040
+#define MHD_PASSWORD 0x0080
+#define MHD_FIRSTVOLUME 0x0100
+#define EARC_NEXT_VOLUME 0x0001
+#define LHD_SPLIT_BEFORE 0x0001
+#define LHD_UNICODE 0x0200
+#define LHD_LARGE 0x0100
+#define LHD_WINDOWMASK 0x00e0
+#define LHD_DIRECTORY 0x00e0
+#define LONG_BLOCK 0x8000
+#define HOST_MSDOS 0
+#define HOST_MAX 6
+#define SIZEOF_MARKHEAD3 7
+#define SIZEOF_SHORTBLOCKHEAD 7
+#define SIZEOF_MAINHEAD3 13
+#define SIZEOF_FILEHEAD3 32
+
+/* RAR 5.0 header types, header flags and archive flags. */
+#define HEAD5_MAIN 1
+#define HEAD5_FILE 2
+#define HEAD5_CRYPT 4
+#define HEAD5_ENDARC 5
+#define EHFL_NEXTVOLUME 0x0001
+#define HFL_EXTRA 0x0001
+#define HFL_DATA 0x0002
+#define HFL_SPLITBEFORE 0x0008
+#define HFL_SPLITAFTER 0x0010
+#define FHFL_DIRECTORY 0x0001
+#define FHFL_UTIME 0x0002
+#define FHFL_CRC32 0x0004
+#define FHFL_UNPUNKNOWN 0x0008
+#define FCI_SOLID 0x0040
+#define FHEXTRA_CRYPT 1
+#define FHEXTRA_HTIME 3
+#define FHEXTRA_HTIME_UNIXTIME 0x0001
+#define FHEXTRA_HTIME_MTIME 0x0002
+#define HSYS5_WINDOWS 0
+#define HSYS5_UNIX 1
+#define HOST_WIN32 2
+#define HOST_UNIX 3
+#define VER_PACK5 50
+#define VER_PACK7 70
+#define UNKNOWN_SIZE 0x7fffffff7fffffffLL
+#define MHFL_VOLUME 0x0001
+#define MHFL_VOLNUMBER 0x0002
+#define MHFL_SOLID 0x0004
+#define MHFL_PROTECT 0x0008
+#define MHFL_LOCK 0x0010
+#define MAX_HEADER_SIZE5 0x200000
+
+static inline u_int
+get2 (const u_char *p)
+{
+  return p[0] | p[1] << 8;
+}
+
+static inline u_long
+get4 (const u_char *p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | u_long (p[3]) << 24;
+}
+
+static inline unsigned __int64
+get8 (const u_char *p)
+{
+  return get4 (p) | (unsigned __int64)get4 (p + 4) << 32;
+}
+
+/* Converts a UTC FILETIME to a local DOS date and time, date in the
+   high word. */
+static DWORD
+dos_time (unsigned __int64 ft)
+{
+  FILETIME utc, lt;
+  utc.dwLowDateTime = DWORD (ft);
+  utc.dwHighDateTime = DWORD (ft >> 32);
+  WORD date, time;
+  if (!FileTimeToLocalFileTime (&utc, &lt)
+      || !FileTimeToDosDateTime (&lt, &date, &time))
+    return 0;
+  return DWORD (date) << 16 | time;
+}
+
+static inline unsigned __int64
+unix_to_filetime (unsigned __int64 t)
+{
+  return (t + 11644473600UL) * 10000000;
+}
+
+/* Reads a RAR 5.0 variable-length integer at P, which must be below E.
+   Returns false if it runs past E or is longer than 64 bits. */
+static bool
+get_vint (const u_char *&p, const u_char *e, unsigned __int64 &v)
+{
+  v = 0;
+  for (int shift = 0; p < e && shift < 64; shift += 7)
+    {
+      int c = *p++;
+      v |= (unsigned __int64)(c & 0x7f) << shift;
+      if (!(c & 0x80))
+        return true;
+    }
+  return false;
+}
+
+int
+rar_headers::open (const char *path)
+{
+  m_version = 0;
+  m_flags = 0;
+  m_marker = -1;
+  if (!m_mf.open (path, FILE_FLAG_RANDOM_ACCESS))
+    return ERROR_ARC_FILE_OPEN;
+  __try
+    {
+      return find_marker ();
+    }
+  __except (MAPF_FILTER)
+    {
+      return ERROR_CANNOT_READ;
+    }
+}
+
+/* Most archives start with the marker, so the rest of SFX_SCAN_MAX is
+   only mapped if the first window does not have it. */
+int
+rar_headers::find_marker ()
+{
+  if (!m_mf.size ())
+    return ERROR_NOT_ARC_FILE;
+  DWORD len = MAPF_WINDOW;
+  const u_char *p = (const u_char *)m_mf.view (0, len);
+  if (!p)
+    return ERROR_CANNOT_READ;
+  /* RAR 1.4 archives are left to UnRAR.DLL. */
+  if (len >= 4 && !memcmp (p, "RE~^", 4))
+    return ERROR_NOT_SUPPORT;
+  int off = find_rar_marker (p, len, &m_version);
+  if (off < 0 && len < m_mf.size ())
+    {
+      len = SFX_SCAN_MAX;
+      p = (const u_char *)m_mf.view (0, len);
+      if (!p)
+        return ERROR_CANNOT_READ;
+      off = find_rar_marker (p, len, &m_version);
+    }
+  if (off < 0)
+    return ERROR_NOT_ARC_FILE;
+  m_marker = off;
+  return m_version == 4 ? open_rar4 () : open_rar5 ();
+}
+
+int
+rar_headers::open_rar4 ()
+{
+  m_pos = m_marker + SIZEOF_MARKHEAD3;
+  DWORD len = SIZEOF_MAINHEAD3;
+  const u_char *p = (const u_char *)m_mf.view (m_pos, len);
+  if (!p || len < SIZEOF_MAINHEAD3 || p[2] != HEAD3_MAIN)
+    return ERROR_HEADER_BROKEN;
+  u_int flags = get2 (p + 3);
+  DWORD size = get2 (p + 5);
+  if (size < SIZEOF_MAINHEAD3)
+    return ERROR_HEADER_BROKEN;
+  len = size;
+  p = (const u_char *)m_mf.view (m_pos, len);
+  if (!p || len < size)
+    return ERROR_HEADER_BROKEN;
+
+  /* An old style comment inside the main header is not covered by its
+     CRC. */
+  u_int crc = get2 (p);
+  if ((crc32 (0, p + 2, size - 2) & 0xffff) != crc
+      && (!(flags & MHD_COMMENT)
+          || (crc32 (0, p + 2, SIZEOF_MAINHEAD3 - 2) & 0xffff) != crc))
+    return ERROR_HEADER_CRC;
+  m_pos += size;
+
+  if (flags & MHD_VOLUME)
+    m_flags |= UNRAR_ARC_VOLUME;
+  m_new_numbering = (flags & MHD_NEWNUMBERING) != 0;
+  if (flags & MHD_FIRSTVOLUME)
+    m_flags |= UNRAR_ARC_FIRSTVOLUME;
+  if (flags & MHD_SOLID)
+    m_flags |= UNRAR_ARC_SOLID;
+  if (flags & MHD_LOCK)
+    m_flags |= UNRAR_ARC_LOCKED;
+  if (flags & MHD_PROTECT)
+    m_flags |= UNRAR_ARC_RECOVERY;
+  if (flags & MHD_PASSWORD)
+    m_flags |= UNRAR_ARC_ENCRYPTED_HEADERS;
+  return 0;
+}
+
+int
+rar_headers::open_rar5 ()
+{
+  m_pos = m_marker + RAR5_MARKER_SIZE;
+  DWORD len = 4 + 4;
+  const u_char *p = (const u_char *)m_mf.view (m_pos, len);
+  if (!p)
+    return ERROR_HEADER_BROKEN;
+  const u_char *q = p + 4;
+  unsigned __int64 hsize;
+  if (len < 5 || !get_vint (q, p + len, hsize) || !hsize
+      || hsize > MAX_HEADER_SIZE5)
+    return ERROR_HEADER_BROKEN;
+  DWORD size = DWORD (q - p) + DWORD (hsize);
+  len = size;
+  p = (const u_char *)m_mf.view (m_pos, len);
+  if (!p || len < size)
+    return ERROR_HEADER_BROKEN;
+  if (crc32 (0, p + 4, size - 4) != get4 (p))
+    return ERROR_HEADER_CRC;
+  m_pos += size;
+
+  const u_char *const e = p + size;
+  q = p + (size - DWORD (hsize));
+  unsigned __int64 type, hflags, v;
+  if (!get_vint (q, e, type))
+    return ERROR_HEADER_BROKEN;
+  if (type == HEAD5_CRYPT)
+    {
+      m_flags |= UNRAR_ARC_ENCRYPTED_HEADERS;
+      return 0;
+    }
+  if (type != HEAD5_MAIN || !get_vint (q, e, hflags)
+      || (hflags & HFL_EXTRA && !get_vint (q, e, v))
+      || (hflags & HFL_DATA && !get_vint (q, e, v))
+      || !get_vint (q, e, v))
+    return ERROR_HEADER_BROKEN;
+
+  m_new_numbering = true;
+  if (v & MHFL_VOLUME)
+    {
+      m_flags |= UNRAR_ARC_VOLUME;
+      if (!(v & MHFL_VOLNUMBER))
+        m_flags |= UNRAR_ARC_FIRSTVOLUME;
+    }
+  if (v & MHFL_SOLID)
+    m_flags |= UNRAR_ARC_SOLID;
+  if (v & MHFL_LOCK)
+    m_flags |= UNRAR_ARC_LOCKED;
+  if (v & MHFL_PROTECT)
+    m_flags |= UNRAR_ARC_RECOVERY;
+  return 0;
+}
+
+int
+rar_headers::next (rar_entry &e)
+{
+  if (m_flags & UNRAR_ARC_ENCRYPTED_HEADERS)
+    return ERROR_NOT_SUPPORT;
+  int r;
+  __try
+    {
+      r = m_version == 4 ? next_rar4 (e) : next_rar5 (e);
+    }
+  __except (MAPF_FILTER)
+    {
+      r = ERROR_CANNOT_READ;
+    }
+  if (!r)
+    m_more = (e.flags & FRAR_NEXTVOL) != 0;
+  return r;
+}
+
+/* Moves past N bytes of headers or data, unless that runs past the
+   end of the file. */
+bool
+rar_headers::skip (unsigned __int64 n)
+{
+  if (n > (unsigned __int64)(m_mf.size () - m_pos))
+    return false;
+  m_pos += n;
+  return true;
+}
+
+int
+rar_headers::next_rar4 (rar_entry &e)
+{
+  for (;;)
+    {
+      if (m_pos == m_mf.size ())
+        return ERROR_EOF;
+      DWORD len = SIZEOF_SHORTBLOCKHEAD;
+      const u_char *p = (const u_char *)m_mf.view (m_pos, len);
+      if (!p)
+        return ERROR_CANNOT_READ;
+      if (len < SIZEOF_SHORTBLOCKHEAD)
+        return ERROR_HEADER_BROKEN;
+      int type = p[2];
+      u_int flags = get2 (p + 3);
+      DWORD size = get2 (p + 5);
+      if (size < SIZEOF_SHORTBLOCKHEAD)
+        return ERROR_HEADER_BROKEN;
+      if (type == HEAD3_ENDARC)
+        {
+          if (flags & EARC_NEXT_VOLUME)
+            m_more = true;
+          return ERROR_EOF;
+        }
+      len = size;
+      p = (const u_char *)m_mf.view (m_pos, len);
+      if (!p || len < size)
+        return ERROR_HEADER_BROKEN;
+
+      if (type != HEAD3_FILE && type != HEAD3_SERVICE)
+        {
+          if (flags & LONG_BLOCK && size < SIZEOF_SHORTBLOCKHEAD + 4)
+            return ERROR_HEADER_BROKEN;
+          if (!skip (size) || (flags & LONG_BLOCK && !skip (get4 (p + 7))))
+            return ERROR_HEADER_BROKEN;
+          continue;
+        }
+
+      if (size < SIZEOF_FILEHEAD3
+          || (flags & LHD_LARGE && size < SIZEOF_FILEHEAD3 + 8))
+        return ERROR_HEADER_BROKEN;
+      int64 pack, unp;
+      pack.s.l = get4 (p + 7);
+      unp.s.l = get4 (p + 11);
+      pack.s.h = flags & LHD_LARGE ? get4 (p + 32) : 0;
+      unp.s.h = flags & LHD_LARGE ? get4 (p + 36) : 0;
+      if (pack.d < 0 || !skip (size) || !skip (pack.d))
+        return ERROR_HEADER_BROKEN;
+      if (type == HEAD3_SERVICE)
+        continue;
+
+      if ((crc32 (0, p + 2, size - 2) & 0xffff) != get2 (p))
+        return ERROR_HEADER_CRC;
+      DWORD name_off = SIZEOF_FILEHEAD3 + (flags & LHD_LARGE ? 8 : 0);
+      DWORD name_size = get2 (p + 26);
+      if (name_off + name_size > size)
+        return ERROR_HEADER_BROKEN;
+
+      e.name = (const char *)p + name_off;
+      e.name_len = name_size;
+      e.name_utf8 = false;
+      e.name_enc = 0;
+      e.name_enc_len = 0;
+      if (flags & LHD_UNICODE)
+        {
+          /* Without a narrow name before a NUL, the name is in UTF-8. */
+          const char *nul = (const char *)memchr (e.name, 0, name_size);
+          if (nul)
+            {
+              e.name_len = DWORD (nul - e.name);
+              e.name_enc = (const u_char *)nul + 1;
+              e.name_enc_len = name_size - e.name_len - 1;
+            }
+          else
+            e.name_utf8 = true;
+        }
+      e.flags = flags;
+      e.unp_size = unp.d;
+      e.pack_size = pack.d;
+      e.host_os = p[15];
+      /* UnRAR.DLL reads plain names from DOS and Windows in the OEM
+         code page. */
+      e.name_oem = (!(flags & LHD_UNICODE)
+                    && (e.host_os == HOST_MSDOS || e.host_os == HOST_WIN32));
+      e.crc = get4 (p + 16);
+      e.time = get4 (p + 20);
+      e.unp_ver = p[24];
+      e.method = p[25];
+      e.attr = get4 (p + 28);
+      /* As UnRAR.DLL fixes up headers written by old or unknown
+         systems. */
+      if (e.unp_ver < 20 && e.attr & FILE_ATTRIBUTE_DIRECTORY)
+        e.flags |= LHD_DIRECTORY;
+      if (e.host_os >= HOST_MAX)
+        e.attr = ((e.flags & LHD_WINDOWMASK) == LHD_DIRECTORY
+                  ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_ARCHIVE);
+      return 0;
+    }
+}
+
+/* Reads the extra area of a file header for the modification time,
+   and for whether the file is encrypted. */
+static void
+read_extra5 (const u_char *q, const u_char *e, rar_entry &ent)
+{
+  while (q < e)
+    {
+      unsigned __int64 size, type;
+      if (!get_vint (q, e, size) || !size || size > (unsigned __int64)(e - q))
+        return;
+      const u_char *next = q + size;
+      if (!get_vint (q, next, type))
+        return;
+      if (type == FHEXTRA_CRYPT)
+        ent.flags |= FRAR_ENCRYPTED;
+      else if (type == FHEXTRA_HTIME)
+        {
+          unsigned __int64 flags;
+          if (get_vint (q, next, flags) && flags & FHEXTRA_HTIME_MTIME)
+            {
+              if (flags & FHEXTRA_HTIME_UNIXTIME)
+                {
+                  if (next - q >= 4)
+                    ent.time = dos_time (unix_to_filetime (get4 (q)));
+                }
+              else if (next - q >= 8)
+                ent.time = dos_time (get8 (q));
+            }
+        }
+      q = next;
+    }
+}
+
+int
+rar_headers::next_rar5 (rar_entry &e)
+{
+  for (;;)
+    {
+      if (m_pos == m_mf.size ())
+        return ERROR_EOF;
+      DWORD len = 4 + 4;
+      const u_char *p = (const u_char *)m_mf.view (m_pos, len);
+      if (!p)
+        return ERROR_CANNOT_READ;
+      const u_char *q = p + 4;
+      unsigned __int64 hsize;
+      if (len < 5 || !get_vint (q, p + len, hsize) || !hsize
+          || hsize > MAX_HEADER_SIZE5)
+        return ERROR_HEADER_BROKEN;
+      DWORD size = DWORD (q - p) + DWORD (hsize);
+      len = size;
+      p = (const u_char *)m_mf.view (m_pos, len);
+      if (!p || len < size)
+        return ERROR_HEADER_BROKEN;
+      if (crc32 (0, p + 4, size - 4) != get4 (p))
+        return ERROR_HEADER_CRC;
+
+      const u_char *const end = p + size;
+      q = p + (size - DWORD (hsize));
+      unsigned __int64 type, hflags, extra = 0, data = 0;
+      if (!get_vint (q, end, type) || !get_vint (q, end, hflags)
+          || (hflags & HFL_EXTRA && !get_vint (q, end, extra))
+          || (hflags & HFL_DATA && !get_vint (q, end, data))
+          || extra > (unsigned __int64)(end - q)
+          || !skip (size) || !skip (data))
+        return ERROR_HEADER_BROKEN;
+      if (type == HEAD5_ENDARC)
+        {
+          unsigned __int64 eflags;
+          if (get_vint (q, end, eflags) && eflags & EHFL_NEXTVOLUME)
+            m_more = true;
+          return ERROR_EOF;
+        }
+      if (type != HEAD5_FILE)
+        continue;
+
+      const u_char *const extra_area = end - DWORD (extra);
+      unsigned __int64 fflags, unp, attr, comp, host, name_len;
+      if (!get_vint (q, extra_area, fflags) || !get_vint (q, extra_area, unp)
+          || !get_vint (q, extra_area, attr))
+        return ERROR_HEADER_BROKEN;
+      e.time = 0;
+      if (fflags & FHFL_UTIME)
+        {
+          if (extra_area - q < 4)
+            return ERROR_HEADER_BROKEN;
+          e.time = dos_time (unix_to_filetime (get4 (q)));
+          q += 4;
+        }
+      e.crc = 0;
+      if (fflags & FHFL_CRC32)
+        {
+          if (extra_area - q < 4)
+            return ERROR_HEADER_BROKEN;
+          e.crc = get4 (q);
+          q += 4;
+        }
+      if (!get_vint (q, extra_area, comp) || !get_vint (q, extra_area, host)
+          || !get_vint (q, extra_area, name_len)
+          || name_len > (unsigned __int64)(extra_area - q))
+        return ERROR_HEADER_BROKEN;
+
+      e.name = (const char *)q;
+      e.name_len = DWORD (name_len);
+      e.name_utf8 = true;
+      e.name_oem = false;
+      e.name_enc = 0;
+      e.name_enc_len = 0;
+
+      /* The flags are given the RAR 1.5-4.x layout that the rest of
+         unrar32 expects, with the dictionary size in bits 5-7. */
+      e.flags = 0;
+      if (hflags & HFL_SPLITBEFORE)
+        e.flags |= FRAR_PREVVOL;
+      if (hflags & HFL_SPLITAFTER)
+        e.flags |= FRAR_NEXTVOL;
+      if (comp & FCI_SOLID)
+        e.flags |= FRAR_SOLID;
+      if (fflags & FHFL_DIRECTORY)
+        e.flags |= LHD_DIRECTORY;
+      else
+        e.flags |= min (int ((comp >> 10) & 0x1f) + 1, 6) << 5;
+      e.unp_size = fflags & FHFL_UNPUNKNOWN ? UNKNOWN_SIZE : (__int64)unp;
+      e.pack_size = (__int64)data;
+      e.attr = DWORD (attr);
+      e.method = 0x30 + int ((comp >> 7) & 7);
+      e.unp_ver = comp & 0x3f ? VER_PACK7 : VER_PACK5;
+      e.host_os = host == HSYS5_WINDOWS ? HOST_WIN32 : HOST_UNIX;
+      read_extra5 (extra_area, end, e);
+      return 0;
+    }
+}
+
+/* Decodes the Unicode name of a RAR 1.5-4.x header into W, as UnRAR
+   does: a high byte shared by the name, and runs of flags telling for
+   each character whether it is a byte with that high byte, a byte
+   without, a full 16-bit character, or a run taken from the narrow
+   name.  Returns the number of characters. */
+int
+rar_entry::decode_name (wchar_t *w, int size) const
+{
+  const u_char *raw = (const u_char *)name;
+  DWORD raw_len = name_len + 1 + name_enc_len;
+  const u_char *s = name_enc, *const se = name_enc + name_enc_len;
+  int n = 0;
+  if (s == se)
+    return 0;
+  u_int high = *s++ << 8;
+  u_int flags = 0;
+  int nbits = 0;
+  while (s < se && n < size)
+    {
+      if (!nbits)
+        {
+          flags = *s++;
+          nbits = 8;
+          if (s == se)
+            break;
+        }
+      switch ((flags >> 6) & 3)
+        {
+        case 0:
+          w[n++] = *s++;
+          break;
+
+        case 1:
+          w[n++] = wchar_t (*s++ + high);
+          break;
+
+        case 2:
+          if (se - s < 2)
+            return n;
+          w[n++] = wchar_t (s[0] + (s[1] << 8));
+          s += 2;
+          break;
+
+        case 3:
+          {
+            int run = *s++;
+            u_int corr = 0;
+            bool corrected = (run & 0x80) != 0;
+            if (corrected)
+              {
+                if (s == se)
+                  return n;
+                corr = *s++;
+              }
+            /* UnRAR lets a run go on past the narrow name into the
+               NUL and the encoded bytes that follow it. */
+            for (run = (run & 0x7f) + 2;
+                 run > 0 && n < size && DWORD (n) < raw_len; run--, n++)
+              w[n] = (corrected
+                      ? wchar_t (((raw[n] + corr) & 0xff) + high)
+                      : wchar_t (raw[n]));
+          }
+          break;
+        }
+      flags <<= 2;
+      nbits -= 2;
+    }
+  return n;
+}
+
+/* Copies the name into BUF as UnRAR.DLL reports it: in the ANSI code
+   page, with `/' turned into `\'.  Returns its length, or -1 if the
+   archive could not be read or the name cannot be converted. */
+int
+rar_entry::copy_name (char *buf, int size) const
+{
+  int l;
+  __try
+    {
+      wchar_t w[FRAR_PATH_MAX];
+      int n = 0;
+      if (name_utf8)
+        {
+          n = MultiByteToWideChar (CP_UTF8, 0, name, name_len, w,
+                                   FRAR_PATH_MAX - 1);
+          if (!n && name_len)
+            {
+              *buf = 0;
+              return -1;
+            }
+        }
+      else if (name_enc)
+        n = decode_name (w, FRAR_PATH_MAX - 1);
+
+      /* As in UnRAR, an empty Unicode name leaves the narrow one. */
+      if (n)
+        {
+          for (int i = 0; i < n; i++)
+            if (w[i] == '/')
+              w[i] = '\\';
+          char a[FRAR_PATH_MAX * 2];
+          l = WideCharToMultiByte (CP_ACP, 0, w, n, a, sizeof a, 0, 0);
+          if (!l)
+            {
+              *buf = 0;
+              return -1;
+            }
+          l = min (l, size - 1);
+          memcpy (buf, a, l);
+        }
+      else
+        {
+          l = min (int (name_len), size - 1);
+          if (name_oem)
+            OemToCharBuff (name, buf, l);
+          else
+            memcpy (buf, name, l);
+          for (int i = 0; i < l; i++)
+            if (iskanji (buf[i]) && i + 1 < l)
+              i++;
+            else if (buf[i] == '/')
+              buf[i] = '\\';
+        }
+    }
+  __except (MAPF_FILTER)
+    {
+      *buf = 0;
+      return -1;
+    }
+  buf[l] = 0;
+  return l;
+}
+
+/* Turns PATH into the name of the next volume, as UnRAR names them:
+   arc.part1.rar, arc.part2.rar... with NEW_NUMBERING, and arc.rar,
+   arc.r00, arc.r01... arc.r99, arc.s00... otherwise.  The first volume
+   of an SFX set may end in .exe.  PATH must have room for MAX_PATH
+   bytes. */
+bool
+next_volume_name (char *path, bool new_numbering)
+{
+  char *base = find_last_slash (path);
+  base = base ? base + 1 : path;
+  char *ext = strrchr (base, '.');
+  if (!ext)
+    ext = base + strlen (base);
+  if (!*ext || !ext[1] || !_stricmp (ext, ".exe") || !_stricmp (ext, ".sfx"))
+    {
+      if (ext - path + sizeof ".rar" > MAX_PATH)
+        return false;
+      strcpy (ext, ".rar");
+      if (!new_numbering)
+        return true;
+    }
+
+  if (!new_numbering)
+    {
+      if (!isdigit (u_char (ext[2])) || !isdigit (u_char (ext[3])))
+        {
+          if (ext - path + sizeof ".r00" > MAX_PATH)
+            return false;
+          strcpy (ext + 2, "00");
+          return true;
+        }
+      for (char *p = ext + 3; ++*p == '9' + 1;)
+        if (p[-1] == '.')
+          {
+            *p = 'A';
+            break;
+          }
+        else
+          *p-- = '0';
+      return true;
+    }
+
+  char *p = ext;
+  while (p > base && !isdigit (u_char (p[-1])))
+    p--;
+  if (p == base)
+    return false;
+  for (p--; ++*p == '9' + 1; p--)
+    {
+      *p = '0';
+      if (p == base || !isdigit (u_char (p[-1])))
+        {
+          if (strlen (path) + 2 > MAX_PATH)
+            return false;
+          memmove (p + 1, p, strlen (p) + 1);
+          *p = '1';
+          break;
+        }
+    }
+  return true;
+}
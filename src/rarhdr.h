@@ -0,0 +1,99 @@
+/*
+ *   Copyright (c) 1998-2004 T. Kamei (kamei@jsdlab.co.jp)
+ *
+ *   Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose is hereby granted provided
+ * that the above copyright notice and this permission notice appear
+ * in all copies of the software and related documentation.
+ *
+ *                          NO WARRANTY
+ *
+ *   THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY WARRANTIES;
+ * WITHOUT EVEN THE IMPLIED WARRANTIES OF MERCHANTABILITY OR FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef _rarhdr_h_
+#define _rarhdr_h_
+
+/* A file header as found by rar_headers::next, with the fields laid out
+   as UnRAR.DLL reports them in RARHeaderDataEx.  NAME points into the
+   mapping and is only valid until the next call; it is not terminated.
+   It is in UTF-8 if NAME_UTF8 is set, and in the OEM code page if
+   NAME_OEM is.  A RAR 1.5-4.x Unicode name comes as NAME in the
+   archive's code page followed by NAME_ENC, the encoded Unicode
+   name. */
+struct rar_entry
+{
+  const char *name;
+  DWORD name_len;
+  bool name_utf8;
+  bool name_oem;
+  const u_char *name_enc;
+  DWORD name_enc_len;
+  DWORD flags;
+  __int64 unp_size;
+  __int64 pack_size;
+  DWORD crc;
+  DWORD time;
+  DWORD attr;
+  int method;
+  int host_os;
+  int unp_ver;
+
+  int copy_name (char *buf, int size) const;
+  int decode_name (wchar_t *w, int size) const;
+};
+
+/* The headers of a RAR archive, read straight from the mapped file
+   without UnRAR.DLL.  open finds the marker block, at the start of the
+   file or inside an SFX stub, and checks the main header and its CRC.
+   The flags are those of UNRARARCHIVEINFO.  next then walks the file
+   headers, skipping the data between them, and returns ERROR_EOF
+   after the last one, at the end archive header or the end of the
+   file.  A header or data running past the end of the file gives
+   ERROR_HEADER_BROKEN instead.  The parts of a file continued from the previous
+   volume come with FRAR_PREVVOL, and are not listed by UnRAR.DLL.
+   more_volumes tells at the end whether the volume has a successor. */
+class rar_headers
+{
+public:
+  rar_headers ()
+       : m_version (0), m_flags (0), m_marker (-1), m_pos (0),
+         m_new_numbering (false), m_more (false)
+    {}
+  int open (const char *path);
+  int next (rar_entry &e);
+  int version () const
+    {return m_version;}
+  bool new_numbering () const
+    {return m_new_numbering;}
+  bool more_volumes () const
+    {return m_more;}
+  UINT flags () const
+    {return m_flags;}
+  __int64 marker () const
+    {return m_marker;}
+
+private:
+  mapf m_mf;
+  int m_version;
+  UINT m_flags;
+  __int64 m_marker;
+  __int64 m_pos;
+  bool m_new_numbering;
+  bool m_more;
+
+  int find_marker ();
+  int open_rar4 ();
+  int open_rar5 ();
+  int next_rar4 (rar_entry &e);
+  int next_rar5 (rar_entry &e);
+  bool skip (unsigned __int64 n);
+  void operator = (const rar_headers &);
+  rar_headers (const rar_headers &);
+};
+
+bool next_volume_name (char *path, bool new_numbering);
+
+#endif /* _rarhdr_h_ */
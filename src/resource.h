@@ -47,8 +47,6 @@
 #define IDS_CREATING                    10023
 #define IDS_CANNOT_CREATE               10024
 #define IDS_EXTRACTING_FROM             10025
-#define IDS_TEST_NOT_IMPL               10026
-#define IDS_PRINT_NOT_IMPL              10027
 #define IDS_COMMENT_NOT_IMPL            10028
 #define IDS_DISK_FULL                   10029
 #define IDS_SKIPPING                    10030
@@ -56,6 +54,11 @@
 #define IDS_UNRAR_NOT_LOADED            10032
 #define IDS_FILTER                      10033
 #define IDS_INVALID_SECURITY_LEVEL      10034
+#define IDS_TESTING_FROM                10035
+#define IDS_TEST_OK                     10036
+#define IDS_TEST_SUMMARY                10037
+#define IDS_TEST_ERRORS                 10038
+#define IDS_TEST_ABORTED                10039
 
 // Next default values for new objects
 // 
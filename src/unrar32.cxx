@@ -16,17 +16,25 @@
 #include "comm-arc.h"
 #include <commctrl.h>
 #include <stdio.h>
+#include <process.h>
 #define EXTERN /* empty */
 #include "unrarapi.h"
 #include "util.h"
+#include "hdrindex.h"
+#include "mapf.h"
+#include "rarhdr.h"
 #include "arcinfo.h"
+#include "dialog.h"
 #include "rar.h"
 #include "unrar32.h"
 #include "resource.h"
-#include "dialog.h"
 
 #define UNRAR32_VERSION 12
 
+/* Counts the API calls in progress.  In exclusive mode, a call made
+   while another is running fails as busy, as it always used to;
+   otherwise only calls on the same archive handle wait for each
+   other. */
 class in_progress
 {
   static LONG lock;
@@ -34,7 +42,8 @@ class in_progress
 public:
   in_progress () {non_zero = InterlockedIncrement (&lock);}
   ~in_progress () {InterlockedDecrement (&lock);}
-  bool is_locked () const {return non_zero != 0L;}
+  bool is_locked () const {return non_zero != 0L && lstate.exclusive;}
+  static bool is_running () {return lock != -1L;}
 };
 
 LONG in_progress::lock = -1;
@@ -62,8 +71,26 @@ UnrarGetVersion ()
 BOOL WINAPI
 UnrarGetRunning ()
 {
-  IN_API (1, 1);
-  return 0;
+  return lstate.hrardll ? in_progress::is_running () : 1;
+}
+
+/* Entering exclusive mode, the owner registered by the calling thread
+   becomes the one for the whole process, so that it is not lost;
+   registrations always go to the process-wide owner as well, so none
+   is lost leaving it. */
+BOOL WINAPI
+UnrarSetExclusiveMode (BOOL exclusive)
+{
+  if (!lstate.hrardll)
+    return 0;
+  if (exclusive && !lstate.exclusive)
+    {
+      owner_info *owner = thread_owner (false);
+      if (owner && owner->has_callback)
+        lstate.owner = *owner;
+    }
+  InterlockedExchange (&lstate.exclusive, exclusive != 0);
+  return 1;
 }
 
 BOOL WINAPI
@@ -108,14 +135,17 @@ UnrarSetCursorInterval (WORD interval)
   return 1;
 }
 
-int WINAPI
-Unrar (HWND hwnd, LPCSTR args, LPSTR buf, DWORD size)
+BOOL WINAPI
+UnrarSetIndexCache (LPCSTR dir, DWORD max_size)
 {
-  if (!lstate.hrardll)
-    no_unrar_dll (hwnd);
-
-  IN_API (ERROR_NOT_SUPPORT, ERROR_ALREADY_RUNNING);
+  IN_API (0, 0);
+  return header_index::configure (dir, max_size);
+}
 
+static int
+run_unrar (HWND hwnd, LPCSTR args, LPSTR buf, DWORD size,
+           LPUNRAROUTPUTPROC proc, LPVOID param)
+{
   cmdline cl;
   int e = cl.parse (args, 1);
   if (e)
@@ -124,22 +154,74 @@ Unrar (HWND hwnd, LPCSTR args, LPSTR buf, DWORD size)
   bool disable = !hwnd || EnableWindow (hwnd, 0);
 
   ostrbuf obuf (buf, size);
+  if (proc)
+    obuf.set_sink (proc, param);
   UnRAR unrar (hwnd, obuf);
   int x = unrar.xmain (cl.argc (), cl.argv ());
+  if (!obuf.flush () && !x)
+    x = ERROR_USER_CANCEL;
   if (!disable)
     EnableWindow (hwnd, 1);
   return x;
 }
 
-BOOL WINAPI
-UnrarCheckArchive (const char *path, int mode)
+int WINAPI
+Unrar (HWND hwnd, LPCSTR args, LPSTR buf, DWORD size)
 {
-  IN_API (0, 0);
+  if (!lstate.hrardll)
+    no_unrar_dll (hwnd);
+
+  IN_API (ERROR_NOT_SUPPORT, ERROR_ALREADY_RUNNING);
+  return run_unrar (hwnd, args, buf, size, 0, 0);
+}
+
+int WINAPI
+UnrarEx (HWND hwnd, LPCSTR args, LPSTR buf, DWORD size,
+         LPUNRAROUTPUTPROC proc, LPVOID param)
+{
+  if (!lstate.hrardll)
+    no_unrar_dll (hwnd);
+
+  IN_API (ERROR_NOT_SUPPORT, ERROR_ALREADY_RUNNING);
+  return run_unrar (hwnd, args, buf, size, proc, param);
+}
+
+static int
+sfx_result (const char *path, int mode)
+{
+  __int64 marker;
+  if (mode & CHECKARCHIVE_SFX
+      && probe_sfx (path, &marker) == SFX_WIN32_UNKNOWN)
+    return 0x8000 + SFX_WIN32_UNKNOWN;
+  return 1;
+}
 
+/* In a batch no password is ever asked for, so any error on an archive
+   that wanted one is put down to the missing password; a single check
+   only does so for ERAR_UNKNOWN, as it always has. */
+static int
+check_archive (const char *path, int mode, bool batch = false)
+{
   if ((mode & (CHECKARCHIVE_MASK | CHECKARCHIVE_ALL))
       == (CHECKARCHIVE_RAPID | CHECKARCHIVE_ALL))
     mode = (mode & ~CHECKARCHIVE_MASK) | CHECKARCHIVE_BASIC;
 
+  /* A rapid check only looks at the marker and the main header, unless
+     the headers are encrypted and UnRAR.DLL has to ask for the
+     password.  Only a file that is plainly not a sound archive is
+     turned down here; anything else, such as a file that could not
+     be read, is left to UnRAR.DLL. */
+  if ((mode & CHECKARCHIVE_MASK) == CHECKARCHIVE_RAPID)
+    {
+      rar_headers rh;
+      int e = rh.open (path);
+      if (!e && !(rh.flags () & UNRAR_ARC_ENCRYPTED_HEADERS))
+        return rh.marker () ? sfx_result (path, mode) : 1;
+      if (e == ERROR_NOT_ARC_FILE || e == ERROR_HEADER_CRC
+          || e == ERROR_HEADER_BROKEN)
+        return 0;
+    }
+
   rarData rd;
   if (!rd.open (path,
                 ((mode & CHECKARCHIVE_MASK) == CHECKARCHIVE_FULLCRC
@@ -165,32 +247,156 @@ UnrarCheckArchive (const char *path, int mode)
         break;
       }
   if (e && e != ERAR_END_ARCHIVE){
-    if(ERAR_UNKNOWN==e && rd.is_missing_password)return ERROR_PASSWORD_FILE;
+    if((batch || ERAR_UNKNOWN==e) && rd.is_missing_password)
+      return ERROR_PASSWORD_FILE;
     else return 0;
   }
 
-  if (mode & CHECKARCHIVE_SFX
-      && file_executable_p (path))
-    return 0x8000 + SFX_WIN32_UNKNOWN;
+  return sfx_result (path, mode);
+}
 
-  return 1;
+BOOL WINAPI
+UnrarCheckArchive (const char *path, int mode)
+{
+  IN_API (0, 0);
+  return check_archive (path, mode);
 }
 
+/* Reads the marker and main header of PATH without UnRAR.DLL. */
 int WINAPI
-UnrarGetFileCount (const char *path)
+UnrarGetArchiveInfo (LPCSTR path, LPUNRARARCHIVEINFO ai)
 {
-  IN_API (-1, -1);
+  IN_API (ERROR_NOT_SUPPORT, ERROR_ALREADY_RUNNING);
+  if (!path || !ai)
+    return -1;
+  rar_headers rh;
+  int e = rh.open (path);
+  if (e)
+    return e;
+  ai->uVersion = rh.version ();
+  ai->uFlags = rh.flags ();
+  ai->llMarkerOffset = rh.marker ();
+  return 0;
+}
+
+static int
+get_file_count (const char *path, bool can_ask_password)
+{
+  header_index index;
+  bool recording = header_index::enabled ();
+  if ((recording && index.load (path)) || index.build (path))
+    return index.count ();
 
   rarData rd;
   if (!rd.open (path, RAR_OM_LIST))
     return -1;
 
+  rd.can_ask_password = can_ask_password;
   rarSetCallback(rd.h,rar_event_handler,(LPARAM)&rd);
 
   int e, nfiles;
   for (nfiles = 0; !(e = rd.read_header ()) && !(e = rd.skip ()); nfiles++)
-    ;
-  return !e || e == ERAR_END_ARCHIVE ? nfiles : -1;
+    if (recording)
+      recording = index.add (rd.hd);
+  if (e != ERAR_END_ARCHIVE)
+    return -1;
+  if (recording && !rd.asked_password)
+    index.save (path);
+  return nfiles;
+}
+
+int WINAPI
+UnrarGetFileCount (const char *path)
+{
+  IN_API (-1, -1);
+  return get_file_count (path, true);
+}
+
+/* A batch of archives to be probed by several threads at once.  Each
+   thread takes the next path until there are none left. */
+struct probe_batch
+{
+  const LPCSTR *paths;
+  int *results;
+  int count;
+  int mode;
+  bool count_files;
+  LONG next;
+};
+
+static unsigned __stdcall
+probe_thread_proc (void *arg)
+{
+  probe_batch *b = (probe_batch *)arg;
+  for (LONG i; (i = InterlockedIncrement (&b->next)) < b->count;)
+    b->results[i] = (b->count_files
+                     ? get_file_count (b->paths[i], false)
+                     : check_archive (b->paths[i], b->mode, true));
+  return 0;
+}
+
+static void
+run_batch (probe_batch &b, int nthreads)
+{
+  if (nthreads <= 0)
+    nthreads = processor_count ();
+  nthreads = min (nthreads, min (b.count, int (MAXIMUM_WAIT_OBJECTS)));
+  b.next = -1;
+
+  HANDLE threads[MAXIMUM_WAIT_OBJECTS];
+  int n = 0;
+  if (nthreads > 1)
+    for (; n < nthreads; n++)
+      {
+        threads[n] = HANDLE (_beginthreadex (0, 0, probe_thread_proc,
+                                             &b, 0, 0));
+        if (!threads[n])
+          break;
+      }
+  if (!n)
+    probe_thread_proc (&b);
+  else
+    {
+      WaitForMultipleObjects (n, threads, 1, INFINITE);
+      for (int i = 0; i < n; i++)
+        CloseHandle (threads[i]);
+    }
+}
+
+int WINAPI
+UnrarCheckArchiveBatch (const LPCSTR *paths, int count, int mode,
+                        int *results, int nthreads)
+{
+  IN_API (ERROR_NOT_SUPPORT, ERROR_ALREADY_RUNNING);
+  if (count < 0 || (count && (!paths || !results)))
+    return ERROR_NOT_SUPPORT;
+  /* Password prompts from several threads at once would pile up, so
+     archives that need one are reported as such instead. */
+  probe_batch b;
+  b.paths = paths;
+  b.results = results;
+  b.count = count;
+  b.mode = mode | CHECKARCHIVE_NOT_ASK_PASSWORD;
+  b.count_files = false;
+  run_batch (b, nthreads);
+  return 0;
+}
+
+int WINAPI
+UnrarGetFileCountBatch (const LPCSTR *paths, int count, int *results,
+                        int nthreads)
+{
+  IN_API (ERROR_NOT_SUPPORT, ERROR_ALREADY_RUNNING);
+  if (count < 0 || (count && (!paths || !results)))
+    return ERROR_NOT_SUPPORT;
+  probe_batch b;
+  b.paths = paths;
+  b.results = results;
+  b.count = count;
+  b.mode = 0;
+  b.count_files = true;
+  run_batch (b, nthreads);
+  return 0;
 }
 
 BOOL WINAPI
@@ -267,7 +473,21 @@ UnrarExtractMem (HWND hwnd, LPCSTR szCmdLine,
                  LPWORD lpwAttr, LPDWORD lpdwWriteSize)
 {
   IN_API (ERROR_NOT_SUPPORT, ERROR_ALREADY_RUNNING);
-  return ERROR_NOT_SUPPORT;
+
+  cmdline cl;
+  int e = cl.parse (szCmdLine, 1);
+  if (e)
+    return e;
+
+  bool disable = !hwnd || EnableWindow (hwnd, 0);
+
+  ostrbuf obuf (0, 0);
+  UnRAR unrar (hwnd, obuf);
+  int x = unrar.extract_mem (cl.argc (), cl.argv (), szBuffer, dwSize,
+                             lpTime, lpwAttr, lpdwWriteSize);
+  if (!disable)
+    EnableWindow (hwnd, 1);
+  return x;
 }
 
 int WINAPI
@@ -292,41 +512,45 @@ UnrarOpenArchive (HWND hwnd, LPCSTR path, DWORD mode)
   try {info = new arcinfo;} catch (...) {}
   if (!info)
     return 0;
-  if (!info->open (path, mode))
+  if (!info->harc () || !info->open (path, mode))
     {
       delete info;
       return 0;
     }
 
-  rarSetCallback(info->m_hunrar,rar_openarc_handler,(LPARAM)info);
+  if (info->m_hunrar)
+    rarSetCallback(info->m_hunrar,rar_openarc_handler,(LPARAM)info);
+  if (mode & M_SNAPSHOT_HEADERS && info->snapshot ())
+    {
+      delete info;
+      return 0;
+    }
 
-  return HARC (info);
+  return info->harc ();
 }
 
 int WINAPI
 UnrarCloseArchive (HARC harc)
 {
   IN_API (ERROR_NOT_SUPPORT, ERROR_ALREADY_RUNNING);
-  arcinfo *info = arcinfo::find (harc);
-  if (!info)
-    return ERROR_HARC_ISNOT_OPENED;
-  info->close ();
-  delete info;
-  return 0;
+  return arcinfo::destroy (harc);
 }
 
 int WINAPI
 UnrarFindFirst (HARC harc, LPCSTR pattern, INDIVIDUALINFO *vinfo)
 {
   IN_API (-1, -1);
-  arcinfo *info = arcinfo::find (harc);
-  if (!info || !info->m_is_first_time)
+  arcinfo_ref info (harc);
+  if (!info || (!info->m_is_first_time && !info->m_from_index))
     return -1;
 
-  if (info->m_cl.parse (pattern, 0))
+  info->m_cl.discard ();
+  if (info->m_cl.parse (pattern, 0)
+      || !info->m_glob.set_pattern (info->m_cl.argc (), info->m_cl.argv ()))
     return -1;
-  info->m_glob.set_pattern (info->m_cl.argc (), info->m_cl.argv ());
   info->m_is_first_time = false;
+  if (info->m_from_index)
+    info->rewind ();
   return info->findnext (vinfo, 0);
 }
 
@@ -334,7 +558,7 @@ int WINAPI
 UnrarFindNext (HARC harc, INDIVIDUALINFO *vinfo)
 {
   IN_API (-1, -1);
-  arcinfo *info = arcinfo::find (harc);
+  arcinfo_ref info (harc);
   if (!info || info->m_is_first_time)
     return -1;
   return info->findnext (vinfo, 1);
@@ -344,7 +568,7 @@ int WINAPI
 UnrarGetArcFileName (HARC harc, LPSTR buf, int size)
 {
   IN_API (ERROR_NOT_SUPPORT, ERROR_ALREADY_RUNNING);
-  arcinfo *info = arcinfo::find (harc);
+  arcinfo_ref info (harc);
   if (!info)
     return ERROR_HARC_ISNOT_OPENED;
   if (int (strlen (info->m_arcpath)) >= size)
@@ -357,7 +581,7 @@ DWORD WINAPI
 UnrarGetArcFileSize (HARC harc)
 {
   IN_API (DWORD (-1), DWORD (-1));
-  arcinfo *info = arcinfo::find (harc);
+  arcinfo_ref info (harc);
   return info && !info->m_arcsize.s.h ? info->m_arcsize.s.l : -1;
 }
 
@@ -365,7 +589,7 @@ BOOL WINAPI
 UnrarGetArcFileSizeEx (HARC harc, ULHA_INT64 *lpllSize)
 {
   IN_API (DWORD (-1), DWORD (-1));
-  arcinfo *info = arcinfo::find (harc);
+  arcinfo_ref info (harc);
   if (info) {
     *lpllSize = info->m_arcsize.d;
     return TRUE;
@@ -378,7 +602,7 @@ DWORD WINAPI
 UnrarGetArcOriginalSize (HARC harc)
 {
   IN_API (DWORD (-1), DWORD (-1));
-  arcinfo *info = arcinfo::find (harc);
+  arcinfo_ref info (harc);
   return info && !info->m_orig_sz.s.h ? info->m_orig_sz.s.l : -1;
 }
 
@@ -386,7 +610,7 @@ BOOL WINAPI
 UnrarGetArcOriginalSizeEx (HARC harc, ULHA_INT64 *lpllSize)
 {
   IN_API (DWORD (-1), DWORD (-1));
-  arcinfo *info = arcinfo::find (harc);
+  arcinfo_ref info (harc);
   if (info) {
     *lpllSize = info->m_orig_sz.d;
     return TRUE;
@@ -399,7 +623,7 @@ DWORD WINAPI
 UnrarGetArcCompressedSize (HARC harc)
 {
   IN_API (DWORD (-1), DWORD (-1));
-  arcinfo *info = arcinfo::find (harc);
+  arcinfo_ref info (harc);
   return info && !info->m_comp_sz.s.h ? info->m_comp_sz.s.l : -1;
 }
 
@@ -407,7 +631,7 @@ BOOL WINAPI
 UnrarGetArcCompressedSizeEx (HARC harc, ULHA_INT64 *lpllSize)
 {
   IN_API (DWORD (-1), DWORD (-1));
-  arcinfo *info = arcinfo::find (harc);
+  arcinfo_ref info (harc);
   if (info) {
     *lpllSize = info->m_comp_sz.d;
     return TRUE;
@@ -420,7 +644,7 @@ WORD WINAPI
 UnrarGetArcRatio (HARC harc)
 {
   IN_API (WORD (-1), WORD (-1));
-  arcinfo *info = arcinfo::find (harc);
+  arcinfo_ref info (harc);
   return info ? calc_ratio (info->m_comp_sz, info->m_orig_sz) : -1;
 }
 
@@ -428,7 +652,7 @@ WORD WINAPI
 UnrarGetArcDate (HARC harc)
 {
   IN_API (WORD (-1), WORD (-1));
-  arcinfo *info = arcinfo::find (harc);
+  arcinfo_ref info (harc);
   return info ? info->m_arcdate : -1;
 }
 
@@ -436,7 +660,7 @@ WORD WINAPI
 UnrarGetArcTime (HARC harc)
 {
   IN_API (WORD (-1), WORD (-1));
-  arcinfo *info = arcinfo::find (harc);
+  arcinfo_ref info (harc);
   return info ? info->m_arctime : -1;
 }
 
@@ -444,7 +668,7 @@ UINT WINAPI
 UnrarGetArcOSType (HARC harc)
 {
   IN_API (UINT (-1), UINT (-1));
-  arcinfo *info = arcinfo::find (harc);
+  arcinfo_ref info (harc);
   return info ? OSTYPE_UNKNOWN : -1;
 }
 
@@ -452,15 +676,15 @@ int WINAPI
 UnrarIsSFXFile (HARC harc)
 {
   IN_API (-1, -1);
-  arcinfo *info = arcinfo::find (harc);
-  return info ? info->m_sfx : -1;
+  arcinfo_ref info (harc);
+  return info ? info->sfx () : -1;
 }
 
 int WINAPI
 UnrarGetFileName (HARC harc, LPSTR buf, int size)
 {
   IN_API (ERROR_NOT_SUPPORT, ERROR_ALREADY_RUNNING);
-  arcinfo *info = arcinfo::find (harc);
+  arcinfo_ref info (harc);
   if (!info)
     return ERROR_HARC_ISNOT_OPENED;
   if (!info->m_is_valid)
@@ -475,7 +699,7 @@ int WINAPI
 UnrarGetMethod (HARC harc, LPSTR buf, int size)
 {
   IN_API (ERROR_NOT_SUPPORT, ERROR_ALREADY_RUNNING);
-  arcinfo *info = arcinfo::find (harc);
+  arcinfo_ref info (harc);
   if (!info)
     return ERROR_HARC_ISNOT_OPENED;
   if (!info->m_is_valid)
@@ -491,7 +715,7 @@ DWORD WINAPI
 UnrarGetOriginalSize (HARC harc)
 {
   IN_API (DWORD (-1), DWORD (-1));
-  arcinfo *info = arcinfo::find (harc);
+  arcinfo_ref info (harc);
   return info && info->m_is_valid && !info->m_hd.UnpSizeHigh ? info->m_hd.UnpSize : -1;
 }
 
@@ -499,7 +723,7 @@ BOOL WINAPI
 UnrarGetOriginalSizeEx (HARC harc, ULHA_INT64 *lpllSize)
 {
   IN_API (DWORD (-1), DWORD (-1));
-  arcinfo *info = arcinfo::find (harc);
+  arcinfo_ref info (harc);
   if (info && info->m_is_valid) {
     *lpllSize = (ULHA_INT64)info->m_hd.UnpSizeHigh <<32 | (ULHA_INT64)info->m_hd.UnpSize;
     return TRUE;
@@ -512,7 +736,7 @@ DWORD WINAPI
 UnrarGetCompressedSize (HARC harc)
 {
   IN_API (DWORD (-1), DWORD (-1));
-  arcinfo *info = arcinfo::find (harc);
+  arcinfo_ref info (harc);
   return info && info->m_is_valid && !info->m_hd.PackSizeHigh ? info->m_hd.PackSize : -1;
 }
 
@@ -520,7 +744,7 @@ BOOL WINAPI
 UnrarGetCompressedSizeEx (HARC harc, ULHA_INT64 *lpllSize)
 {
   IN_API (DWORD (-1), DWORD (-1));
-  arcinfo *info = arcinfo::find (harc);
+  arcinfo_ref info (harc);
   if (info && info->m_is_valid) {
     *lpllSize = (ULHA_INT64)info->m_hd.PackSizeHigh <<32 | (ULHA_INT64)info->m_hd.PackSize;
     return TRUE;
@@ -533,7 +757,7 @@ WORD WINAPI
 UnrarGetRatio (HARC harc)
 {
   IN_API (WORD (-1), WORD (-1));
-  arcinfo *info = arcinfo::find (harc);
+  arcinfo_ref info (harc);
   return (info && info->m_is_valid
           ? calc_ratio (info->m_hd.PackSizeHigh, info->m_hd.PackSize,
                         info->m_hd.UnpSizeHigh, info->m_hd.UnpSize)
@@ -544,7 +768,7 @@ WORD WINAPI
 UnrarGetDate (HARC harc)
 {
   IN_API (WORD (-1), WORD (-1));
-  arcinfo *info = arcinfo::find (harc);
+  arcinfo_ref info (harc);
   return info && info->m_is_valid ? HIWORD (info->m_hd.FileTime) : -1;
 }
 
@@ -552,7 +776,7 @@ WORD WINAPI
 UnrarGetTime (HARC harc)
 {
   IN_API (WORD (-1), WORD (-1));
-  arcinfo *info = arcinfo::find (harc);
+  arcinfo_ref info (harc);
   return info && info->m_is_valid ? LOWORD (info->m_hd.FileTime) : -1;
 }
 
@@ -578,7 +802,7 @@ DWORD WINAPI
 UnrarGetCRC (HARC harc)
 {
   IN_API (DWORD (-1), DWORD (-1));
-  arcinfo *info = arcinfo::find (harc);
+  arcinfo_ref info (harc);
   return info && info->m_is_valid ? info->m_hd.FileCRC : -1;
 }
 
@@ -586,7 +810,7 @@ int WINAPI
 UnrarGetAttribute (HARC harc)
 {
   IN_API (-1, -1);
-  arcinfo *info = arcinfo::find (harc);
+  arcinfo_ref info (harc);
   return info && info->m_is_valid ? info->m_hd.FileAttr : -1;
 }
 
@@ -594,31 +818,107 @@ UINT WINAPI
 UnrarGetOSType (HARC harc)
 {
   IN_API (UINT (-1), UINT (-1));
-  arcinfo *info = arcinfo::find (harc);
+  arcinfo_ref info (harc);
   if (!info || !info->m_is_valid)
     return UINT (-1);
   return os_type (info->m_hd.HostOS);
 }
 
+int WINAPI
+UnrarGetFileInfoByName (HARC harc, LPCSTR name, LPUNRARFILEINFO fi)
+{
+  IN_API (ERROR_NOT_SUPPORT, ERROR_ALREADY_RUNNING);
+  arcinfo_ref info (harc);
+  if (!info)
+    return ERROR_HARC_ISNOT_OPENED;
+  if (!name || !fi)
+    return -1;
+  int e;
+  int i = info->lookup (name, e);
+  if (i < 0)
+    return e ? e : -1;
+
+  rarHeaderData hd;
+  info->m_index.get (i, hd);
+  fi->llOriginalSize = info->m_index.unp_size (i);
+  fi->llCompressedSize = info->m_index.pack_size (i);
+  fi->dwCRC = hd.FileCRC;
+  fi->dwAttributes = hd.FileAttr;
+  fi->uFlag = hd.Flags;
+  fi->uOSType = os_type (hd.HostOS);
+  fi->wRatio = WORD (calc_ratio (hd.PackSizeHigh, hd.PackSize,
+                                 hd.UnpSizeHigh, hd.UnpSize));
+  fi->wDate = HIWORD (hd.FileTime);
+  fi->wTime = LOWORD (hd.FileTime);
+  strlcpy (fi->szFileName, hd.FileName, sizeof fi->szFileName);
+  attr_string (hd.FileAttr, fi->szAttribute);
+  strcpy (fi->szMode, method_string (hd.Method));
+  return 0;
+}
+
+/* Every owner registered is the owner for the whole process, as it
+   used to be, so that a call made from another thread still reports
+   to it.  Outside exclusive mode it is also kept for the registering
+   thread, and overrides the process-wide one for the operations that
+   thread starts, whatever other threads register later. */
+static BOOL
+set_owner (HWND hwnd, LPARCHIVERPROC proc)
+{
+  if (lstate.exclusive)
+    {
+      if (lstate.owner.has_callback)
+        return 0;
+    }
+  else
+    {
+      owner_info *owner = thread_owner (true);
+      if (!owner || owner->has_callback)
+        return 0;
+      owner->has_callback = true;
+      owner->hwnd_owner = hwnd;
+      owner->callback = proc;
+    }
+  lstate.owner.has_callback = true;
+  lstate.owner.hwnd_owner = hwnd;
+  lstate.owner.callback = proc;
+  return 1;
+}
+
+/* Drops the registration of the calling thread and the process-wide
+   one, or with HWND only those made for it.  Returns whether any was
+   dropped. */
+static bool
+clear_owner (HWND hwnd, bool any)
+{
+  owner_info *owners[2] = {thread_owner (false), &lstate.owner};
+  bool found = false;
+  for (int i = 0; i < 2; i++)
+    {
+      owner_info *owner = owners[i];
+      if (owner && (any || (owner->has_callback
+                            && owner->hwnd_owner == hwnd)))
+        {
+          found = found || owner->has_callback;
+          owner->has_callback = false;
+          owner->hwnd_owner = 0;
+          owner->callback = 0;
+        }
+    }
+  return found;
+}
+
 BOOL WINAPI
 UnrarSetOwnerWindow (HWND hwnd)
 {
   IN_API (0, 0);
-  if (lstate.has_callback)
-    return 0;
-  lstate.has_callback = true;
-  lstate.hwnd_owner = hwnd;
-  lstate.callback = 0;
-  return 1;
+  return set_owner (hwnd, 0);
 }
 
 BOOL WINAPI
 UnrarClearOwnerWindow ()
 {
   IN_API (0, 0);
-  lstate.has_callback = false;
-  lstate.hwnd_owner = 0;
-  lstate.callback = 0;
+  clear_owner (0, true);
   return 1;
 }
 
@@ -626,24 +926,14 @@ BOOL WINAPI
 UnrarSetOwnerWindowEx (HWND hwnd, LPARCHIVERPROC proc)
 {
   IN_API (0, 0);
-  if (lstate.has_callback)
-    return 0;
-  lstate.has_callback = true;
-  lstate.hwnd_owner = hwnd;
-  lstate.callback = proc;
-  return 1;
+  return set_owner (hwnd, proc);
 }
 
 BOOL WINAPI
 UnrarKillOwnerWindowEx (HWND hwnd)
 {
   IN_API (0, 0);
-  if (!lstate.has_callback || hwnd != lstate.hwnd_owner)
-    return 0;
-  lstate.has_callback = false;
-  lstate.hwnd_owner = 0;
-  lstate.callback = 0;
-  return 1;
+  return clear_owner (hwnd, false);
 }
 
 int WINAPI
@@ -653,12 +943,20 @@ DllMain (HINSTANCE hinst, DWORD reason, VOID *)
     {
     case DLL_PROCESS_ATTACH:
       lstate.hinst = hinst;
+      lstate.tls_owner = TlsAlloc ();
       lstate.hrardll = load_rarapi ();
       init_table ();
       InitCommonControls ();
       break;
 
+    case DLL_THREAD_DETACH:
+      free_thread_owner ();
+      break;
+
     case DLL_PROCESS_DETACH:
+      free_thread_owner ();
+      if (lstate.tls_owner != TLS_OUT_OF_INDEXES)
+        TlsFree (lstate.tls_owner);
       arcinfo::cleanup ();
       if (lstate.hrardll)
         FreeLibrary (lstate.hrardll);
@@ -98,10 +98,22 @@ SOURCE=.\dialog.cxx
 # End Source File
 # Begin Source File
 
+SOURCE=.\hdrindex.cxx
+# End Source File
+# Begin Source File
+
+SOURCE=.\mapf.cxx
+# End Source File
+# Begin Source File
+
 SOURCE=.\rar.cxx
 # End Source File
 # Begin Source File
 
+SOURCE=.\rarhdr.cxx
+# End Source File
+# Begin Source File
+
 SOURCE=.\unrar32.cxx
 # End Source File
 # Begin Source File
@@ -138,6 +150,10 @@ SOURCE=.\dialog.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\hdrindex.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\mapf.h
 # End Source File
 # Begin Source File
@@ -146,6 +162,10 @@ SOURCE=.\rar.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\rarhdr.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\resource.h
 # End Source File
 # Begin Source File
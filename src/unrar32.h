@@ -22,17 +22,68 @@
 extern "C" {
 #endif
 
+/* UnrarOpenArchive: read all the headers at once. */
+#define M_SNAPSHOT_HEADERS	0x00000004L
+
+/* UnrarGetFileInfoByName */
+typedef struct
+{
+  ULHA_INT64 llOriginalSize;
+  ULHA_INT64 llCompressedSize;
+  DWORD dwCRC;
+  DWORD dwAttributes;
+  UINT  uFlag;
+  UINT  uOSType;
+  WORD  wRatio;
+  WORD  wDate;
+  WORD  wTime;
+  char  szFileName[FNAME_MAX32 + 1];
+  char  szAttribute[8];
+  char  szMode[8];
+}
+  UNRARFILEINFO, *LPUNRARFILEINFO;
+
+/* UnrarGetArchiveInfo */
+#define UNRAR_ARC_VOLUME		0x0001
+#define UNRAR_ARC_FIRSTVOLUME		0x0002
+#define UNRAR_ARC_SOLID			0x0004
+#define UNRAR_ARC_LOCKED		0x0008
+#define UNRAR_ARC_RECOVERY		0x0010
+#define UNRAR_ARC_ENCRYPTED_HEADERS	0x0020
+
+typedef struct
+{
+  UINT  uVersion;
+  UINT  uFlags;
+  ULHA_INT64 llMarkerOffset;
+}
+  UNRARARCHIVEINFO, *LPUNRARARCHIVEINFO;
+
+typedef BOOL (WINAPI *LPUNRAROUTPUTPROC)(LPCSTR lpData, DWORD dwSize,
+                                         LPVOID lpParam);
+
 WORD WINAPI UnrarGetVersion ();
 BOOL WINAPI UnrarGetRunning ();
+BOOL WINAPI UnrarSetExclusiveMode (BOOL exclusive);
 BOOL WINAPI UnrarGetBackGroundMode ();
 BOOL WINAPI UnrarSetBackGroundMode (BOOL mode);
 BOOL WINAPI UnrarGetCursorMode ();
 BOOL WINAPI UnrarSetCursorMode (BOOL cursor_mode);
 WORD WINAPI UnrarGetCursorInterval ();
 BOOL WINAPI UnrarSetCursorInterval (WORD interval);
+BOOL WINAPI UnrarSetIndexCache (LPCSTR dir, DWORD max_size);
+int WINAPI UnrarGetFileInfoByName (HARC harc, LPCSTR name,
+                                   LPUNRARFILEINFO info);
 int WINAPI Unrar (HWND hwnd, LPCSTR args, LPSTR buf, DWORD size);
+int WINAPI UnrarEx (HWND hwnd, LPCSTR args, LPSTR buf, DWORD size,
+                    LPUNRAROUTPUTPROC proc, LPVOID param);
 BOOL WINAPI UnrarCheckArchive (const char *path, int mode);
 int WINAPI UnrarGetFileCount (const char *path);
+int WINAPI UnrarCheckArchiveBatch (const LPCSTR *paths, int count, int mode,
+                                   int *results, int nthreads);
+int WINAPI UnrarGetFileCountBatch (const LPCSTR *paths, int count,
+                                   int *results, int nthreads);
+int WINAPI UnrarGetArchiveInfo (LPCSTR path, LPUNRARARCHIVEINFO info);
 BOOL WINAPI UnrarQueryFunctionList (int i);
 BOOL WINAPI UnrarConfigDialog (HWND hwnd, LPSTR szOptionBuffer, int iMode);
 int WINAPI UnrarExtractMem (HWND hwnd, LPCSTR szCmdLine,
@@ -18,6 +18,7 @@
 #include "comm-arc.h"
 #include "unrarapi.h"
 #include "util.h"
+#include "mapf.h"
 
 static int __stdcall
 ReadHeaderEx (HANDLE h, RARHeaderDataEx *hde)
@@ -104,23 +105,160 @@ rarData::close ()
   return x;
 }
 
-bool
-file_executable_p (const char *path)
+/* Returns the offset of the first RAR marker block in the LEN bytes
+   at P and its format version, 4 or 5, in *VERSION; -1 if there is
+   none.  memchr skips to each candidate `R'. */
+int
+find_rar_marker (const void *p, DWORD len, int *version)
 {
-  bool f = false;
-  FILE *fp = fopen (path, "rb");
-  if (fp)
+  const u_char *const b = (const u_char *)p;
+  const u_char *const e = b + len;
+  for (const u_char *q = b; e - q >= RAR4_MARKER_SIZE; q++)
     {
-      IMAGE_DOS_HEADER dos;
-      IMAGE_NT_HEADERS nt;
-      f = (fread (&dos, sizeof dos, 1, fp) == 1
-           && dos.e_magic == IMAGE_DOS_SIGNATURE
-           && !fseek (fp, dos.e_lfanew, SEEK_SET)
-           && fread (&nt, sizeof nt, 1, fp) == 1
-           && nt.Signature == IMAGE_NT_SIGNATURE);
-      fclose (fp);
+      q = (const u_char *)memchr (q, 'R', e - q - (RAR4_MARKER_SIZE - 1));
+      if (!q)
+        break;
+      if (memcmp (q, "Rar!\x1a\x07", 6))
+        continue;
+      if (!q[6])
+        {
+          *version = 4;
+          return int (q - b);
+        }
+      if (q[6] == 1 && e - q >= RAR5_MARKER_SIZE && !q[7])
+        {
+          *version = 5;
+          return int (q - b);
+        }
     }
-  return f;
+  return -1;
+}
+
+/* Results of probe_sfx, by path, size and time stamp of the file. */
+struct sfx_entry
+{
+  __int64 size;
+  FILETIME mtime;
+  int sfx;
+  __int64 marker;
+  bool used;
+};
+
+static critical_section sfx_lock;
+static path_set sfx_cache (sizeof (sfx_entry));
+static u_int sfx_hand;
+
+/* Past SFX_CACHE_MAX paths, one entry not looked up since the clock
+   hand last went by makes room for each new one. */
+#define SFX_CACHE_MAX 4096
+
+static bool
+sfx_keep (void *data)
+{
+  sfx_entry *c = (sfx_entry *)data;
+  bool used = c->used;
+  c->used = false;
+  return used;
+}
+
+/* Looks at the first SFX_SCAN_MAX bytes of MF for probe_sfx.  Returns
+   -1 if they could not be read. */
+static int
+scan_sfx (mapf &mf, __int64 *marker)
+{
+  int sfx = SFX_NOT;
+  __try
+    {
+      DWORD len = SFX_SCAN_MAX;
+      const u_char *p = (const u_char *)mf.view (0, len);
+      if (!p)
+        return mf.size () ? -1 : SFX_NOT;
+      const IMAGE_DOS_HEADER *dos = (const IMAGE_DOS_HEADER *)p;
+      if (len >= sizeof *dos && dos->e_magic == IMAGE_DOS_SIGNATURE
+          && dos->e_lfanew > 0
+          && dos->e_lfanew + sizeof (IMAGE_NT_HEADERS) <= len
+          && (((const IMAGE_NT_HEADERS *)(p + dos->e_lfanew))->Signature
+              == IMAGE_NT_SIGNATURE))
+        sfx = SFX_WIN32_UNKNOWN;
+      int version;
+      int off = find_rar_marker (p, len, &version);
+      if (off >= 0)
+        *marker = off;
+    }
+  __except (MAPF_FILTER)
+    {
+      *marker = -1;
+      return -1;
+    }
+  return sfx;
+}
+
+/* Tells whether PATH starts with a Win32 executable stub, and finds the
+   offset of the RAR marker within the first SFX_SCAN_MAX bytes, or -1,
+   in *MARKER. */
+int
+probe_sfx (const char *path, __int64 *marker)
+{
+  WIN32_FILE_ATTRIBUTE_DATA fa;
+  if (!GetFileAttributesEx (path, GetFileExInfoStandard, &fa))
+    {
+      *marker = -1;
+      return SFX_NOT;
+    }
+  int64 size;
+  size.s.l = fa.nFileSizeLow;
+  size.s.h = fa.nFileSizeHigh;
+
+  /* The same file reached through a relative path, or through another
+     current directory, is kept under one name. */
+  char key[MAX_PATH + 1], *file;
+  DWORD kl = GetFullPathName (path, sizeof key, key, &file);
+  if (!kl || kl >= sizeof key)
+    {
+      kl = DWORD (strlen (path));
+      if (kl >= sizeof key)
+        kl = 0;
+      else
+        strcpy (key, path);
+    }
+  size_t l = kl;
+
+  {
+    cs_lock lock (sfx_lock);
+    sfx_entry *c = l ? (sfx_entry *)sfx_cache.find (key, l) : 0;
+    if (c && c->size == size.d
+        && !CompareFileTime (&c->mtime, &fa.ftLastWriteTime))
+      {
+        c->used = true;
+        *marker = c->marker;
+        return c->sfx;
+      }
+  }
+
+  *marker = -1;
+  mapf mf;
+  if (!mf.open (path))
+    return SFX_NOT;
+  int sfx = scan_sfx (mf, marker);
+  /* A file that could not be read is looked at again next time. */
+  if (sfx < 0)
+    return SFX_NOT;
+
+  if (!l)
+    return sfx;
+  cs_lock lock (sfx_lock);
+  if (sfx_cache.count () >= SFX_CACHE_MAX)
+    sfx_cache.evict (sfx_hand, sfx_keep);
+  sfx_entry *c = (sfx_entry *)sfx_cache.insert (key, l);
+  if (c)
+    {
+      c->size = size.d;
+      c->mtime = fa.ftLastWriteTime;
+      c->sfx = sfx;
+      c->marker = *marker;
+      c->used = true;
+    }
+  return sfx;
 }
 
 int
@@ -181,10 +319,9 @@ os_type (int os)
     }
 }
 
-const char *
-attr_string (int attr)
+char *
+attr_string (int attr, char *b)
 {
-  static char b[5];
   b[0] = (attr & FILE_ATTRIBUTE_DIRECTORY
           ? 'd'
           : (attr & FILE_ATTRIBUTE_ARCHIVE
@@ -192,5 +329,6 @@ attr_string (int attr)
   b[1] = attr & FILE_ATTRIBUTE_SYSTEM ? 's' : '-';
   b[2] = attr & FILE_ATTRIBUTE_HIDDEN ? 'h' : '-';
   b[3] = attr & FILE_ATTRIBUTE_READONLY ? '-' : 'w';
+  b[4] = 0;
   return b;
 }
@@ -29,6 +29,12 @@ extern "C"
 
 #define FRAR_PATH_MAX (sizeof ((RARHeaderDataEx *)0)->FileName)
 
+/* Sizes of the marker blocks that start RAR 1.5-4.x and RAR 5.0
+   archives, and how far into an SFX file to look for them. */
+#define RAR4_MARKER_SIZE 7
+#define RAR5_MARKER_SIZE 8
+#define SFX_SCAN_MAX (4 * 1024 * 1024)
+
 class rarOpenArchiveData: public RAROpenArchiveData
 {
 public:
@@ -88,11 +94,14 @@ public:
   rarHeaderData hd;
 
   LPVOID pUserData;
+  LPVOID pExtractInfo;
   bool can_ask_password;
   bool is_missing_password;
+  bool asked_password;
 
   rarData ()
-       : h (0),pUserData(NULL),can_ask_password(true),is_missing_password(false)
+       : h (0),pUserData(NULL),pExtractInfo(NULL),can_ask_password(true),is_missing_password(false),
+         asked_password (false)
     {}
   ~rarData ()
     {close ();}
@@ -109,12 +118,13 @@ public:
 };
 
 HINSTANCE load_rarapi ();
-bool file_executable_p (const char *path);
+int find_rar_marker (const void *p, DWORD len, int *version);
+int probe_sfx (const char *path, __int64 *marker);
 int calc_ratio (u_long comp_sz_high, u_long comp_sz_low, u_long orig_sz_high, u_long orig_sz_low);
 union int64;
 int calc_ratio (const int64 &comp_sz, const int64 &orig_sz);
 const char *method_string (int method);
 int os_type (int os);
-const char *attr_string (int attr);
+char *attr_string (int attr, char *b);
 
 #endif
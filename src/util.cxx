@@ -15,10 +15,15 @@
 
 #include <windows.h>
 #include <stdio.h>
+#include <stddef.h>
 #include "comm-arc.h"
 #include "util.h"
 #include "mapf.h"
 
+#ifndef va_copy
+#define va_copy(d, s) ((d) = (s))
+#endif
+
 void
 init_table ()
 {
@@ -30,10 +35,76 @@ init_table ()
     }
   for (i = 'a'; i <= 'z'; i++)
     translate_table[i] = u_char (i - 'a' + 'A');
+  for (i = 0; i < 256; i++)
+    {
+      u_long c = i;
+      for (int j = 0; j < 8; j++)
+        c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+      crc_table[i] = c;
+    }
+}
+
+/* The CRC-32 that RAR uses.  Start with 0 and feed the result back in
+   to checksum data in pieces. */
+u_long
+crc32 (u_long crc, const void *buf, size_t size)
+{
+  const u_char *p = (const u_char *)buf;
+  crc = ~crc;
+  for (; size; size--)
+    crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+  return ~crc;
 }
 
 #define SEPCHAR_P(C) ((C) == '/' || (C) == '\\')
 
+/* The owner registered by the calling thread, if any.  With CREATE,
+   one is made for it when there is none yet. */
+owner_info *
+thread_owner (bool create)
+{
+  if (lstate.tls_owner == TLS_OUT_OF_INDEXES)
+    return 0;
+  owner_info *p = (owner_info *)TlsGetValue (lstate.tls_owner);
+  if (!p && create)
+    {
+      p = (owner_info *)calloc (1, sizeof *p);
+      if (p && !TlsSetValue (lstate.tls_owner, p))
+        {
+          free (p);
+          p = 0;
+        }
+    }
+  return p;
+}
+
+void
+free_thread_owner ()
+{
+  if (lstate.tls_owner == TLS_OUT_OF_INDEXES)
+    return;
+  free (TlsGetValue (lstate.tls_owner));
+  TlsSetValue (lstate.tls_owner, 0);
+}
+
+/* Gets the owner for an operation started by the calling thread: its
+   own if it registered one outside exclusive mode, or else the one
+   registered for the whole process. */
+void
+current_owner (owner_info &owner)
+{
+  owner_info *p = lstate.exclusive ? 0 : thread_owner (false);
+  owner = p && p->has_callback ? *p : lstate.owner;
+}
+
+int
+processor_count ()
+{
+  SYSTEM_INFO si;
+  GetSystemInfo (&si);
+  return si.dwNumberOfProcessors;
+}
+
 char *
 find_last_slash (const char *p)
 {
@@ -178,12 +249,39 @@ stpcpy (char *d, const char *s)
   return d + i;
 }
 
+/* Arguments that have to be copied are carved out of chunks of at
+   least ARENA_CHUNK bytes, which are freed all at once. */
+#define ARENA_CHUNK 65536
+
+struct cmdline::chunk
+{
+  chunk *next;
+  size_t size;
+  size_t used;
+  char data[1];
+};
+
+struct cmdline::view
+{
+  view *next;
+  mapf mf;
+};
+
 void
 cmdline::discard ()
 {
-  for (int i = 0; i < m_ac; i++)
-    if (m_av[i])
-      free (m_av[i]);
+  while (m_arena)
+    {
+      chunk *next = m_arena->next;
+      free (m_arena);
+      m_arena = next;
+    }
+  while (m_views)
+    {
+      view *next = m_views->next;
+      delete m_views;
+      m_views = next;
+    }
   if (m_av)
     free (m_av);
   m_ac = 0;
@@ -194,12 +292,20 @@ cmdline::discard ()
 char *
 cmdline::copyarg (const u_char *s, const u_char *se, int dq)
 {
-  size_t l = se - s - dq;
-  if (!l)
-    return "";
-  char *d0 = (char *)malloc (l + 1);
-  if (!d0)
-    return 0;
+  size_t l = se - s - dq + 1;
+  if (!m_arena || m_arena->size - m_arena->used < l)
+    {
+      size_t size = max (l, size_t (ARENA_CHUNK));
+      chunk *c = (chunk *)malloc (offsetof (chunk, data) + size);
+      if (!c)
+        return 0;
+      c->next = m_arena;
+      c->size = size;
+      c->used = 0;
+      m_arena = c;
+    }
+  char *d0 = m_arena->data + m_arena->used;
+  m_arena->used += l;
   char *d = d0;
   for (; s < se; s++)
     if (*s != '"')
@@ -208,12 +314,82 @@ cmdline::copyarg (const u_char *s, const u_char *se, int dq)
   return d0;
 }
 
+bool
+cmdline::add (char *arg)
+{
+  if (m_ac == m_max)
+    {
+      int max = m_max ? m_max * 2 : 32;
+      char **x = (char **)realloc (m_av, sizeof *x * max);
+      if (!x)
+        return false;
+      m_av = x;
+      m_max = max;
+    }
+  m_av[m_ac++] = arg;
+  return true;
+}
+
 int
-cmdline::parse (const char *cmdline, size_t l, bool resp_ok)
+cmdline::include (const char *path)
+{
+  view *v = 0;
+  try {v = new view;} catch (...) {}
+  if (!v)
+    return ERROR_ENOUGH_MEMORY;
+  v->next = m_views;
+  m_views = v;
+  if (!v->mf.open (path, FILE_FLAG_SEQUENTIAL_SCAN, MAPF_COPY | MAPF_WHOLE))
+    return ERROR_RESPONSE_READ;
+  if (v->mf.size () && !v->mf.base ())
+    return include_lines (v->mf);
+  return scan ((const u_char *)v->mf.base (), size_t (v->mf.size ()),
+               false, true);
+}
+
+/* Parses a response file too large to be mapped whole, a window at a
+   time.  No argument goes on past the end of a line, so each window is
+   cut after its last line break, and its arguments are copied. */
+int
+cmdline::include_lines (mapf &mf)
+{
+  __int64 off = 0;
+  while (off < mf.size ())
+    {
+      __int64 rest = mf.size () - off;
+      DWORD len = DWORD (min (rest, (__int64)MAPF_WINDOW));
+      for (;;)
+        {
+          const u_char *p = (const u_char *)mf.view (off, len);
+          if (!p)
+            return ERROR_RESPONSE_READ;
+          const u_char *e = p + len;
+          if (len < rest)
+            while (e > p && e[-1] != '\n' && e[-1] != '\r')
+              e--;
+          if (e > p)
+            {
+              int r = scan (p, e - p, false, false);
+              if (r)
+                return r;
+              off += e - p;
+              break;
+            }
+          /* A line longer than the window. */
+          if (len > 0x40000000)
+            return ERROR_RESPONSE_READ;
+          len = DWORD (min (rest, (__int64)len * 2));
+        }
+    }
+  return 0;
+}
+
+/* Splits L bytes at CP into arguments.  With IN_PLACE, CP is a private
+   copy of a response file, and each argument is unquoted and
+   terminated over its own bytes and the delimiter after it. */
+int
+cmdline::scan (const u_char *cp, size_t l, bool resp_ok, bool in_place)
 {
-  if (!cmdline)
-    return 0;
-  const u_char *cp = (const u_char *)cmdline;
   const u_char *ce = cp + l;
   const u_char *c0 = 0;
   int dq = 0;
@@ -230,40 +406,38 @@ cmdline::parse (const char *cmdline, size_t l, bool resp_ok)
         case EOF:
         case '\r':
         case '\n':
-          if (c0)
+          if (c0 && cp - c0 > dq)
             {
-              char *arg = copyarg (c0, cp, dq);
-              if (!arg)
-                return ERROR_ENOUGH_MEMORY;
+              char *arg;
+              if (in_place && (c != EOF || dq))
+                {
+                  arg = (char *)c0;
+                  char *d = arg;
+                  if (!dq)
+                    d += cp - c0;
+                  else
+                    for (const u_char *s = c0; s < cp; s++)
+                      if (*s != '"')
+                        *d++ = *s;
+                  *d = 0;
+                }
+              else
+                {
+                  arg = copyarg (c0, cp, dq);
+                  if (!arg)
+                    return ERROR_ENOUGH_MEMORY;
+                }
               if (resp_ok && *arg == '@')
                 {
-                  mapf mf;
-                  int e = mf.open (arg + 1);
-                  free (arg);
-                  if (!e)
-                    return ERROR_RESPONSE_READ;
-                  e = parse ((const char *)mf.base (), mf.size (), 0);
+                  int e = include (arg + 1);
                   if (e)
                     return e;
                 }
-              else if (*arg)
-                {
-                  if (m_ac == m_max)
-                    {
-                      m_max += 32;
-                      char **x = (char **)realloc (m_av, sizeof *x * m_max);
-                      if (!x)
-                        {
-                          free (arg);
-                          return ERROR_ENOUGH_MEMORY;
-                        }
-                      m_av = x;
-                    }
-                  m_av[m_ac++] = arg;
-                }
-              dq = 0;
-              c0 = 0;
+              else if (!add (arg))
+                return ERROR_ENOUGH_MEMORY;
             }
+          dq = 0;
+          c0 = 0;
           if (c == EOF)
             return 0;
           break;
@@ -280,77 +454,236 @@ cmdline::parse (const char *cmdline, size_t l, bool resp_ok)
     }
 }
 
+/* A pattern is compiled into a string of ops ending in OP_END.  An op
+   below 0x100 is a single-byte character, already case-folded; a
+   double-byte character takes two ops with OP_DBCS set. */
+enum
+{
+  OP_DBCS = 0x100,
+  OP_ANY = 0x200,
+  OP_STAR,
+  OP_SEP,
+  OP_END
+};
+
+static inline bool
+literal_op_p (int op)
+{
+  return op < OP_ANY || op == OP_SEP;
+}
+
+static inline const u_char *
+next_char (const u_char *s)
+{
+#ifdef KANJI
+  if (iskanji (*s) && s[1])
+    return s + 2;
+#endif
+  return s + 1;
+}
+
+/* Compares N literal ops with the bytes at S. */
+static inline bool
+literal_match (const u_short *op, int n, const u_char *s)
+{
+  for (const u_short *e = op + n; op < e; op++, s++)
+    {
+      int c = *op;
+      if (c == OP_SEP ? !SEPCHAR_P (*s)
+          : c & OP_DBCS ? *s != (c & 0xff) : translate (*s) != c)
+        return false;
+    }
+  return true;
+}
+
+/* Matches STR against a compiled pattern.  When an op fails, only the
+   last `*' seen is given one more character, and the ops after it are
+   tried again: since `*' never matches a path separator, giving more
+   to an earlier `*' cannot get any further.  So a pattern of M ops
+   takes at most M steps per character of STR. */
 bool
-glob::match (const char *pat, const char *str, bool recursive)
+glob::match (const pattern &pat, const char *str, bool recursive)
 {
-  const u_char *p = reinterpret_cast <const u_char *> (pat);
   const u_char *s = reinterpret_cast <const u_char *> (str);
 
+  if (pat.nprefix && !literal_match (pat.ops, pat.nprefix, s))
+    return false;
+  if (pat.nsuffix && !recursive)
+    {
+      size_t l = strlen (str);
+      if (l < size_t (pat.nprefix + pat.nsuffix)
+          || !literal_match (pat.suffix, pat.nsuffix, s + l - pat.nsuffix))
+        return false;
+    }
+
+  const u_short *p = pat.ops + pat.nprefix;
+  s += pat.nprefix;
+  const u_short *star_p = 0;
+  const u_char *star_s = 0;
   for (;;)
     {
-      int c = *p++;
+      int c = *p;
       switch (c)
         {
-        case 0:
-          return !*s || (recursive && SEPCHAR_P (*s));
+        case OP_STAR:
+          for (; *p == OP_STAR; p++)
+            ;
+          if (*p == OP_END)
+            return recursive || !find_slash (reinterpret_cast <const char *> (s));
+          star_p = p;
+          star_s = s;
+          continue;
 
-        case '?':
-          if (!*s || SEPCHAR_P (*s))
-            return false;
-#ifdef KANJI
-          if (iskanji (*s) && s[1])
-            s++;
-#endif
-          s++;
+        case OP_END:
+          if (!*s || (recursive && SEPCHAR_P (*s)))
+            return true;
           break;
 
-        case '*':
-          for (; *p == '*'; p++)
-            ;
-          if (!*p)
-            return recursive || !find_slash (reinterpret_cast <const char *> (s));
-          for (;;)
+        case OP_ANY:
+          if (*s && !SEPCHAR_P (*s))
             {
-              if (match (reinterpret_cast <const char *> (p),
-                         reinterpret_cast <const char *> (s),
-                         recursive))
-                return true;
-              if (!*s || SEPCHAR_P (*s))
-                return false;
-#ifdef KANJI
-              if (iskanji (*s) && s[1])
-                s++;
-#endif
-              s++;
+              s = next_char (s);
+              p++;
+              continue;
             }
-
-        case '/':
-        case '\\':
-          if (!SEPCHAR_P (*s))
-            return false;
-          s++;
           break;
 
         default:
-#ifdef KANJI
-          if (iskanji (c) && *p)
+          if (c & OP_DBCS)
             {
-              if (u_char (c) != *s++)
-                return false;
-              if (*p++ != *s++)
-                return false;
+              if (*s == (c & 0xff) && s[1] == (p[1] & 0xff))
+                {
+                  s += 2;
+                  p += 2;
+                  continue;
+                }
             }
-          else
-#endif
+          else if (c == OP_SEP ? SEPCHAR_P (*s) : translate (*s) == c)
             {
-              if (translate (c) != translate (*s))
-                return false;
               s++;
+              p++;
+              continue;
             }
+          break;
+        }
+
+      if (!star_p || !*star_s || SEPCHAR_P (*star_s))
+        return false;
+      star_s = next_char (star_s);
+      p = star_p;
+      s = star_s;
+    }
+}
+
+/* Matches STR against the names of the exact patterns whose flags
+   are in MASK.  With RECURSIVE, a leading part of STR up to a
+   separator may match too. */
+bool
+glob::match_exact (const char *str, int mask, bool recursive) const
+{
+  if (!m_nexact)
+    return false;
+  for (const char *s = str;; s++)
+    if (!*s || (recursive && SEPCHAR_P (*s)))
+      {
+        const int *flags = (const int *)m_exact.find (str, s - str);
+        if (flags && *flags & mask)
+          return true;
+        if (!*s)
+          return false;
+      }
+}
+
+/* Walks STR down the trie of `LIT*' patterns.  Each node on the way
+   that ends one of the patterns in MASK is a match, as long as the
+   rest of STR would do for `*'. */
+bool
+glob::match_prefix (const char *str, int mask, bool recursive) const
+{
+  if (!m_ntrie)
+    return false;
+  const u_char *s = reinterpret_cast <const u_char *> (str);
+  int node = 0;
+  for (;;)
+    {
+      if (m_trie[node].flags & mask
+          && (recursive || !find_slash (reinterpret_cast <const char *> (s))))
+        return true;
+      if (!*s)
+        return false;
+#ifdef KANJI
+      if (iskanji (*s) && s[1])
+        {
+          node = trie_child (node, OP_DBCS | *s++);
+          if (node >= 0)
+            node = trie_child (node, OP_DBCS | *s);
+          s++;
+        }
+      else
+#endif
+        {
+          node = trie_child (node, SEPCHAR_P (*s) ? OP_SEP : translate (*s));
+          s++;
         }
+      if (node < 0)
+        return false;
     }
 }
 
+int
+glob::trie_child (int node, int op) const
+{
+  for (int i = m_trie[node].child; i >= 0; i = m_trie[i].next)
+    if (m_trie[i].op == op)
+      return i;
+  return -1;
+}
+
+bool
+glob::add_prefix (const u_short *op, int n, int flags)
+{
+  if (!m_ntrie && new_trie_node (0) < 0)
+    return false;
+  int node = 0;
+  for (const u_short *e = op + n; op < e; op++)
+    {
+      int i = trie_child (node, *op);
+      if (i < 0)
+        {
+          i = new_trie_node (*op);
+          if (i < 0)
+            return false;
+          m_trie[i].next = m_trie[node].child;
+          m_trie[node].child = i;
+        }
+      node = i;
+    }
+  m_trie[node].flags |= flags;
+  return true;
+}
+
+int
+glob::new_trie_node (int op)
+{
+  if (m_ntrie == m_maxtrie)
+    {
+      int max = m_maxtrie ? m_maxtrie * 2 : 64;
+      trie_node *t = (trie_node *)realloc (m_trie, sizeof *t * max);
+      if (!t)
+        return -1;
+      m_trie = t;
+      m_maxtrie = max;
+    }
+  trie_node &t = m_trie[m_ntrie];
+  t.op = u_short (op);
+  t.flags = 0;
+  t.child = -1;
+  t.next = -1;
+  return m_ntrie++;
+}
+
+/* Exact names and `LIT*' patterns are looked up in the hash set and
+   the trie; only the rest are tried one by one. */
 bool
 glob::match (const char *file, bool strict, bool recursive) const
 {
@@ -358,7 +691,10 @@ glob::match (const char *file, bool strict, bool recursive) const
     return true;
   if (strict)
     {
-      for (int i = 0; i < m_npat; i++)
+      if (match_exact (file, PF_SLASH | PF_NOSLASH, recursive)
+          || match_prefix (file, PF_SLASH | PF_NOSLASH, recursive))
+        return true;
+      for (int i = 0; i < m_nwild; i++)
         if (match (m_pat[i], file, recursive))
           return true;
     }
@@ -366,24 +702,289 @@ glob::match (const char *file, bool strict, bool recursive) const
     {
       const char *name = find_last_slash (file);
       name = name ? name + 1 : file;
-      for (int i = 0; i < m_npat; i++)
-        if (match (m_pat[i], find_slash (m_pat[i]) ? file : name, false))
+      if (match_exact (file, PF_SLASH, false)
+          || match_exact (name, PF_NOSLASH, false)
+          || match_prefix (file, PF_SLASH, false)
+          || match_prefix (name, PF_NOSLASH, false))
+        return true;
+      for (int i = 0; i < m_nwild; i++)
+        if (match (m_pat[i], m_pat[i].has_slash ? file : name, false))
           return true;
     }
   return false;
 }
 
 void
+glob::clear ()
+{
+  free (m_pat);
+  free (m_ops);
+  free (m_trie);
+  m_exact.clear ();
+  m_pat = 0;
+  m_ops = 0;
+  m_trie = 0;
+  m_npat = 0;
+  m_nwild = 0;
+  m_nexact = 0;
+  m_ntrie = 0;
+  m_maxtrie = 0;
+}
+
+/* Compiles the patterns in AV.  A trailing slash is dropped. */
+bool
 glob::set_pattern (int ac, char **av)
 {
-  m_npat = ac;
-  m_pat = av;
-  for (int i = 0; i < m_npat; i++)
+  clear ();
+  if (!ac)
+    return true;
+
+  size_t nops = 0;
+  for (int i = 0; i < ac; i++)
     {
-      char *p = find_last_slash (m_pat[i]);
+      char *p = find_last_slash (av[i]);
       if (p && !p[1])
         *p = 0;
+      nops += strlen (av[i]) + 1;
+    }
+  m_pat = (pattern *)malloc (sizeof *m_pat * ac);
+  m_ops = (u_short *)malloc (sizeof *m_ops * nops);
+  if (!m_pat || !m_ops)
+    {
+      clear ();
+      return false;
+    }
+
+  u_short *op = m_ops;
+  for (int i = 0; i < ac; i++)
+    {
+      pattern &pat = m_pat[m_nwild];
+      pat.ops = op;
+      pat.has_slash = find_slash (av[i]) != 0;
+      const u_short *last_star = 0;
+      for (const u_char *s = (const u_char *)av[i]; *s;)
+        {
+          int c = *s++;
+          switch (c)
+            {
+            case '?':
+              *op++ = OP_ANY;
+              break;
+
+            case '*':
+              last_star = op;
+              *op++ = OP_STAR;
+              break;
+
+            case '/':
+            case '\\':
+              *op++ = OP_SEP;
+              break;
+
+            default:
+#ifdef KANJI
+              if (iskanji (c) && *s)
+                {
+                  *op++ = OP_DBCS | c;
+                  *op++ = OP_DBCS | *s++;
+                }
+              else
+#endif
+                *op++ = translate (c);
+              break;
+            }
+        }
+      *op = OP_END;
+
+      for (pat.nprefix = 0; literal_op_p (pat.ops[pat.nprefix]); pat.nprefix++)
+        ;
+      int flags = pat.has_slash ? PF_SLASH : PF_NOSLASH;
+      const u_short *q = pat.ops + pat.nprefix;
+      if (*q == OP_END)
+        {
+          int *p = (int *)m_exact.insert (av[i], strlen (av[i]));
+          if (!p)
+            {
+              clear ();
+              return false;
+            }
+          *p |= flags;
+          m_nexact++;
+          op = pat.ops;
+          continue;
+        }
+      for (; *q == OP_STAR; q++)
+        ;
+      if (*q == OP_END)
+        {
+          if (!add_prefix (pat.ops, pat.nprefix, flags))
+            {
+              clear ();
+              return false;
+            }
+          op = pat.ops;
+          continue;
+        }
+
+      pat.nsuffix = 0;
+      if (last_star)
+        {
+          q = op;
+          for (; q > last_star + 1 && literal_op_p (q[-1]); q--)
+            ;
+          if (q == last_star + 1)
+            {
+              pat.suffix = q;
+              pat.nsuffix = int (op - q);
+            }
+        }
+      op++;
+      m_nwild++;
     }
+  m_npat = ac;
+  return true;
+}
+
+static inline int
+fold_path_char (int c)
+{
+  return c == '/' ? '\\' : translate (c);
+}
+
+u_long
+path_set::hash (const char *path, size_t l)
+{
+  const u_char *s = reinterpret_cast <const u_char *> (path);
+  const u_char *const se = s + l;
+  u_long h = 0;
+  while (s < se)
+    {
+#ifdef KANJI
+      if (iskanji (*s) && s + 1 < se)
+        {
+          h = h * 31 + *s++;
+          h = h * 31 + *s++;
+          continue;
+        }
+#endif
+      h = h * 31 + fold_path_char (*s++);
+    }
+  return h;
+}
+
+bool
+path_set::equal (const char *a, const char *b, size_t l)
+{
+  const u_char *s = reinterpret_cast <const u_char *> (a);
+  const u_char *t = reinterpret_cast <const u_char *> (b);
+  const u_char *const se = s + l;
+  while (s < se)
+    {
+#ifdef KANJI
+      if (iskanji (*s) && s + 1 < se)
+        {
+          if (*s++ != *t++ || *s++ != *t++)
+            return false;
+          continue;
+        }
+#endif
+      if (fold_path_char (*s++) != fold_path_char (*t++))
+        return false;
+    }
+  return true;
+}
+
+void *
+path_set::find (const char *path, size_t l) const
+{
+  if (!m_size)
+    return 0;
+  u_long h = hash (path, l);
+  for (entry *p = m_tab[h & (m_size - 1)]; p; p = p->next)
+    if (p->hash == h && p->len == l && equal (name (p), path, l))
+      return p->data;
+  return 0;
+}
+
+bool
+path_set::grow ()
+{
+  u_int size = m_size ? m_size * 2 : 256;
+  entry **tab = (entry **)calloc (size, sizeof *tab);
+  if (!tab)
+    return false;
+  for (u_int i = 0; i < m_size; i++)
+    for (entry *p = m_tab[i], *next; p; p = next)
+      {
+        next = p->next;
+        entry *&head = tab[p->hash & (size - 1)];
+        p->next = head;
+        head = p;
+      }
+  free (m_tab);
+  m_tab = tab;
+  m_size = size;
+  return true;
+}
+
+void *
+path_set::insert (const char *path, size_t l)
+{
+  void *data = find (path, l);
+  if (data)
+    return data;
+  if (m_count >= m_size && !grow ())
+    return 0;
+  entry *p = (entry *)malloc (offsetof (entry, data) + m_datasize + l + 1);
+  if (!p)
+    return 0;
+  p->hash = hash (path, l);
+  p->len = l;
+  memset (p->data, 0, m_datasize);
+  memcpy (name (p), path, l);
+  name (p)[l] = 0;
+  entry *&head = m_tab[p->hash & (m_size - 1)];
+  p->next = head;
+  head = p;
+  m_count++;
+  return p->data;
+}
+
+/* Removes one entry, going round the table from bucket HAND like a
+   clock hand.  KEEP is asked about each entry passed, and the first
+   one it declines is removed; it would clear a use bit and tell
+   whether it was set, so that recently used entries get another
+   round. */
+bool
+path_set::evict (u_int &hand, bool (*keep) (void *data))
+{
+  if (!m_count)
+    return false;
+  for (u_int n = 0; n <= 2 * m_size; n++, hand++)
+    for (entry **pp = &m_tab[hand & (m_size - 1)]; *pp; pp = &(*pp)->next)
+      if (!keep ((*pp)->data))
+        {
+          entry *p = *pp;
+          *pp = p->next;
+          free (p);
+          m_count--;
+          return true;
+        }
+  return false;
+}
+
+void
+path_set::clear ()
+{
+  for (u_int i = 0; i < m_size; i++)
+    for (entry *p = m_tab[i], *next; p; p = next)
+      {
+        next = p->next;
+        free (p);
+      }
+  free (m_tab);
+  m_tab = 0;
+  m_size = m_count = 0;
 }
 
 int
@@ -400,6 +1001,39 @@ check_kanji_trail (const char *string, u_int off)
 int
 ostrbuf::formatv (const char *fmt, va_list ap)
 {
+  if (m_sink)
+    {
+      /* Nothing is cut off here, so a line that does not fit TMP is
+         formatted again into a larger buffer from the heap. */
+      char tmp[1024], *b = tmp;
+      int n = sizeof tmp, l;
+      for (;;)
+        {
+          va_list aq;
+          va_copy (aq, ap);
+          l = _vsnprintf (b, n - 1, fmt, aq);
+          va_end (aq);
+          if (l >= 0 && l < n - 1)
+            break;
+          char *nb = n < 0x10000000 ? (char *)malloc (n * 2) : 0;
+          if (!nb)
+            {
+              l = n - 1;
+              if (check_kanji_trail (b, l))
+                l--;
+              break;
+            }
+          if (b != tmp)
+            free (b);
+          b = nb;
+          n *= 2;
+        }
+      int x = write (b, l);
+      if (b != tmp)
+        free (b);
+      return x;
+    }
+
   if (space () <= 0)
     return 0;
   int l = _vsnprintf (m_buf, space (), fmt, ap);
@@ -420,6 +1054,55 @@ ostrbuf::formatv (const char *fmt, va_list ap)
   return space () > 0;
 }
 
+bool
+ostrbuf::write (const char *data, DWORD size)
+{
+  if (!m_sink)
+    {
+      if (space () <= 0)
+        return false;
+      DWORD l = min (size, DWORD (space ()));
+      memcpy (m_buf, data, l);
+      m_buf += l;
+      m_size -= l;
+      *m_buf = 0;
+      return l == size;
+    }
+
+  if (m_failed)
+    return false;
+  if (int (size) > space ())
+    {
+      if (!flush ())
+        return false;
+      if (int (size) > space ())
+        {
+          if (!m_sink (data, size, m_param))
+            m_failed = true;
+          return !m_failed;
+        }
+    }
+  memcpy (m_buf, data, size);
+  m_buf += size;
+  m_size -= size;
+  *m_buf = 0;
+  return true;
+}
+
+/* Hands the buffered output to the sink. */
+bool
+ostrbuf::flush ()
+{
+  if (!m_sink || m_failed || m_buf == m_base)
+    return !m_failed;
+  if (!m_sink (m_base, m_buf - m_base, m_param))
+    m_failed = true;
+  m_size += m_buf - m_base;
+  m_buf = m_base;
+  *m_buf = 0;
+  return !m_failed;
+}
+
 int
 ostrbuf::format (const char *fmt, ...)
 {
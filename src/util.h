@@ -26,6 +26,17 @@ EXTERN u_char translate_table[256];
 EXTERN u_char mblead_table[256];
 #define iskanji(c) (mblead_table[(c) & 0xff])
 
+EXTERN u_long crc_table[256];
+
+/* Where extraction events go: a window set by UnrarSetOwnerWindow,
+   or a callback set by UnrarSetOwnerWindowEx. */
+struct owner_info
+{
+  bool has_callback;
+  HWND hwnd_owner;
+  LPARCHIVERPROC callback;
+};
+
 struct lib_state
 {
   HINSTANCE hinst;
@@ -33,62 +44,215 @@ struct lib_state
   int s_bg_mode;
   int s_cursor_mode;
   WORD s_cursor_interval;
-  bool has_callback;
-  HWND hwnd_owner;
-  LPARCHIVERPROC callback;
+  owner_info owner;
+  DWORD tls_owner;
+  LONG exclusive;
 };
 
 EXTERN lib_state lstate;
 
+class critical_section
+{
+public:
+  critical_section ()
+    {InitializeCriticalSection (&m_cs);}
+  ~critical_section ()
+    {DeleteCriticalSection (&m_cs);}
+  void lock ()
+    {EnterCriticalSection (&m_cs);}
+  void unlock ()
+    {LeaveCriticalSection (&m_cs);}
+private:
+  void operator = (const critical_section &);
+  critical_section (const critical_section &);
+  CRITICAL_SECTION m_cs;
+};
+
+class cs_lock
+{
+public:
+  cs_lock (critical_section &cs)
+       : m_cs (cs)
+    {m_cs.lock ();}
+  ~cs_lock ()
+    {m_cs.unlock ();}
+private:
+  void operator = (const cs_lock &);
+  cs_lock (const cs_lock &);
+  critical_section &m_cs;
+};
+
+/* Arguments of a command line, with @FILE replaced by the arguments in
+   FILE.  Response files are mapped copy-on-write and their arguments
+   are terminated and unquoted where they lie, so that only arguments
+   of the command line itself, and of response files too large to map
+   whole, are copied. */
+class mapf;
+
 class cmdline
 {
 public:
   cmdline ()
-       : m_ac (0), m_av (0), m_max (0)
+       : m_ac (0), m_av (0), m_max (0), m_arena (0), m_views (0)
     {}
   ~cmdline ()
     {discard ();}
-  int parse (const char *cmdline, size_t l, bool resp_ok);
+  int parse (const char *cmdline, size_t l, bool resp_ok)
+    {return cmdline ? scan ((const u_char *)cmdline, l, resp_ok, false) : 0;}
   int parse (const char *cmdline, bool resp_ok)
     {return parse (cmdline, cmdline ? strlen (cmdline) : 0, resp_ok);}
   int argc () const {return m_ac;}
   char **argv () const {return m_av;}
+  void discard ();
 
 private:
+  struct chunk;
+  struct view;
   int m_ac;
   char **m_av;
   int m_max;
+  chunk *m_arena;
+  view *m_views;
 
-  static char *copyarg (const u_char *s, const u_char *se, int dq);
-  void discard ();
-};
-
-class glob
-{
-public:
-  glob () : m_npat (0) {}
-  bool match (const char *filename, bool strict, bool recursive) const;
-  void set_pattern (int ac, char **av);
-
-private:
-  int m_npat;
-  char **m_pat;
-
-  static bool match (const char *pat, const char *str, bool recursive);
+  int scan (const u_char *cp, size_t l, bool resp_ok, bool in_place);
+  char *copyarg (const u_char *s, const u_char *se, int dq);
+  bool add (char *arg);
+  int include (const char *path);
+  int include_lines (mapf &mf);
+  void operator = (const cmdline &);
+  cmdline (const cmdline &);
 };
 
+/* Output buffer of Unrar().  Without a sink, output that does not fit
+   is truncated.  With a sink, the buffer only collects output and is
+   handed to the sink whenever it fills up, so output of any length
+   goes through a buffer of fixed size. */
 class ostrbuf
 {
 public:
+  typedef BOOL (WINAPI *sink_proc)(const char *data, DWORD size, void *param);
+
   ostrbuf (char *b, int size)
-       : m_buf (b), m_size (b ? size : 0) {}
+       : m_buf (b), m_size (b ? size : 0), m_base (b), m_sink (0),
+         m_failed (false) {}
+  void set_sink (sink_proc sink, void *param)
+    {
+      m_sink = sink;
+      m_param = param;
+    }
+  bool has_sink () const
+    {return m_sink != 0;}
   int format (const char *fmt, ...);
   int formatv (const char *fmt, va_list);
+  bool write (const char *data, DWORD size);
+  bool flush ();
   int space () const
     {return m_size - 1;}
 private:
   char *m_buf;
   int m_size;
+  char *m_base;
+  sink_proc m_sink;
+  void *m_param;
+  bool m_failed;
+};
+
+/* Set of path names compared the way the file system does: ASCII
+   letters case-insensitively and `/' same as `\'.  Each entry may
+   carry DATASIZE bytes of zero-initialized user data; find and insert
+   return a pointer to it, or 0 if the name is absent or memory ran
+   out.  evict removes one entry for a set used as a bounded cache. */
+class path_set
+{
+public:
+  path_set (size_t datasize = 0)
+       : m_tab (0), m_size (0), m_count (0),
+         m_datasize ((datasize + 7) & ~7)
+    {}
+  ~path_set ()
+    {clear ();}
+  void *find (const char *path, size_t l) const;
+  void *insert (const char *path, size_t l);
+  void clear ();
+  bool evict (u_int &hand, bool (*keep) (void *data));
+  u_int count () const
+    {return m_count;}
+
+private:
+  struct entry
+    {
+      entry *next;
+      u_long hash;
+      size_t len;
+      __int64 data[1];
+    };
+  entry **m_tab;
+  u_int m_size;
+  u_int m_count;
+  size_t m_datasize;
+
+  char *name (entry *p) const
+    {return (char *)p->data + m_datasize;}
+  static u_long hash (const char *path, size_t l);
+  static bool equal (const char *a, const char *b, size_t l);
+  bool grow ();
+  void operator = (const path_set &);
+  path_set (const path_set &);
+};
+
+/* File name patterns, compiled once by set_pattern.  `*' and `?' do
+   not match a path separator; `/' and `\' match each other, and
+   letters match regardless of case.  Patterns without wildcards go
+   into a hash set and `LIT*' patterns into a trie, so that long lists
+   of names cost about the same per file as a single one. */
+class glob
+{
+public:
+  glob ()
+       : m_npat (0), m_nwild (0), m_pat (0), m_ops (0),
+         m_exact (sizeof (int)), m_nexact (0),
+         m_trie (0), m_ntrie (0), m_maxtrie (0)
+    {}
+  ~glob () {clear ();}
+  bool match (const char *filename, bool strict, bool recursive) const;
+  bool set_pattern (int ac, char **av);
+
+private:
+  struct pattern
+    {
+      const u_short *ops;
+      const u_short *suffix;
+      int nprefix;
+      int nsuffix;
+      bool has_slash;
+    };
+  struct trie_node
+    {
+      u_short op;
+      u_char flags;
+      int child;
+      int next;
+    };
+  enum {PF_SLASH = 1, PF_NOSLASH = 2};
+  int m_npat;
+  int m_nwild;
+  pattern *m_pat;
+  u_short *m_ops;
+  path_set m_exact;
+  int m_nexact;
+  trie_node *m_trie;
+  int m_ntrie;
+  int m_maxtrie;
+
+  void clear ();
+  static bool match (const pattern &pat, const char *str, bool recursive);
+  bool match_exact (const char *str, int mask, bool recursive) const;
+  bool match_prefix (const char *str, int mask, bool recursive) const;
+  int trie_child (int node, int op) const;
+  bool add_prefix (const u_short *op, int n, int flags);
+  int new_trie_node (int op);
+  void operator = (const glob &);
+  glob (const glob &);
 };
 
 union int64
@@ -102,6 +266,11 @@ union int64
 };
 
 void init_table ();
+u_long crc32 (u_long crc, const void *buf, size_t size);
+int processor_count ();
+owner_info *thread_owner (bool create);
+void free_thread_owner ();
+void current_owner (owner_info &owner);
 char *find_last_slash (const char *p);
 char *find_slash (const char *p);
 void slash2backsl (char *p);